@@ -0,0 +1,54 @@
+#include <dejavu/compiler/lexer.h>
+#include <dejavu/compiler/identifier.h>
+#include <dejavu/system/buffer.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// lexer throughput on code shaped like large generated scripts
+// build with b_CPPFLAGS=-DDEJAVU_NO_SIMD to compare against the scalar paths
+
+static std::string generate(size_t size) {
+	std::string code;
+	code +=
+		"/*\n"
+		" * generated data table\n"
+		" * ------------------------------------------------------------------\n"
+		" */\n";
+
+	for (int i = 0; code.size() < size; i++) {
+		code += "// entry " + std::to_string(i) + " of the table, see the header above\n";
+		code += "global.item_description_" + std::to_string(i) + " = ";
+		code += "\"a long description string for the item, as found in string tables\";\n";
+		code += "        if (argument_count > 2 && some_long_variable_name[3] == other_name) {\n";
+		code += "            value_" + std::to_string(i) + " = 3.25 * $ff + .5;\n";
+		code += "        }\n";
+	}
+
+	return code;
+}
+
+int main() {
+	const size_t size = 16 << 20;
+	const int runs = 10;
+	std::string code = generate(size);
+
+	size_t tokens = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < runs; r++) {
+		buffer b(code.size(), code.c_str());
+		identifier_pool names;
+		token_stream lexer(b, names);
+		while (lexer.gettoken().type != eof) tokens++;
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	double bytes = double(code.size()) * runs;
+	printf(
+		"lexed %.1f MB, %zu tokens in %.3f s: %.1f MB/s\n",
+		bytes / (1 << 20), tokens, seconds, bytes / (1 << 20) / seconds
+	);
+
+	return 0;
+}
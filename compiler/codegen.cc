@@ -3,16 +3,26 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DataLayout.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
 #include <tuple>
+#include <vector>
 #include <sstream>
 
 using namespace llvm;
 
 node_codegen::node_codegen(const Module &runtime, error_stream &e) :
 	runtime(runtime), dl(&runtime),
-	builder(runtime.getContext()), module("", runtime.getContext()), errors(e) {
+	builder(runtime.getContext()), module("", runtime.getContext()),
+	types(names), errors(e) {
 
 	scope_type = runtime.getTypeByName("struct.scope")->getPointerTo();
+	layout_type = runtime.getTypeByName("struct.layout");
+	cache_type = runtime.getTypeByName("struct.lookup_cache");
 	var_type = runtime.getTypeByName("struct.var");
 	variant_type = runtime.getTypeByName("struct.variant");
 
@@ -24,6 +34,35 @@ node_codegen::node_codegen(const Module &runtime, error_stream &e) :
 	union_diff =
 		dl.getTypeAllocSize(real_type) - dl.getTypeAllocSize(string_type);
 
+	MDBuilder md(module.getContext());
+
+	// the same weights llvm gives __builtin_expect
+	likely_real = md.createBranchWeights(64, 4);
+
+	// a variant's tag and payload are disjoint, but a whole variant covers both
+	MDNode *tbaa_root = md.createTBAARoot("gml tbaa");
+	MDNode *variant_node = md.createTBAAScalarTypeNode("variant", tbaa_root);
+	MDNode *tag_node = md.createTBAAScalarTypeNode("variant tag", variant_node);
+	MDNode *payload_node =
+		md.createTBAAScalarTypeNode("variant payload", variant_node);
+	MDNode *var_node = md.createTBAAScalarTypeNode("var", tbaa_root);
+	MDNode *scope_node = md.createTBAAScalarTypeNode("scope", tbaa_root);
+	variant_tbaa = md.createTBAAStructTagNode(variant_node, variant_node, 0);
+	tag_tbaa = md.createTBAAStructTagNode(tag_node, tag_node, 0);
+	payload_tbaa = md.createTBAAStructTagNode(payload_node, payload_node, 0);
+	var_tbaa = md.createTBAAStructTagNode(var_node, var_node, 0);
+	scope_tbaa = md.createTBAAStructTagNode(scope_node, scope_node, 0);
+
+	argument_name = names.intern("argument", 8);
+	argument_count_name = names.intern("argument_count", 14);
+	for (size_t i = 0; i < max_arguments; i++) {
+		std::string name = "argument" + std::to_string(i);
+		argument_names[i] = names.intern(name.data(), name.size());
+	}
+
+	ir_passes.add(create_redundant_lookups());
+	ir_passes.add(create_dead_code());
+
 	// todo: create a gml calling convention for the runtime
 	to_real = Function::Create(
 		runtime.getFunction("to_real")->getFunctionType(),
@@ -70,6 +109,46 @@ node_codegen::node_codegen(const Module &runtime, error_stream &e) :
 		Function::ExternalLinkage, "lookup", &module
 	);
 
+	// the runtime's errors exit, so none of it unwinds
+	Function *runtime_functions[] = {
+		to_real, to_string, intern, access, retain, release, retain_var,
+		release_var, insert_globalvar, lookup_default, lookup
+	};
+	for (Function *f : runtime_functions) f->addFnAttr(Attribute::NoUnwind);
+
+	// conversions only read the variant they're passed, and the refcounts are
+	// in the strings, not the variants. none of them is readonly as a whole,
+	// since a conversion's error writes to stderr and exits
+	Function *variant_readers[] = { to_real, to_string, retain, release, retain_var };
+	for (Function *f : variant_readers) {
+		f->addAttribute(1, Attribute::ReadOnly);
+		f->addAttribute(1, Attribute::NoCapture);
+	}
+	release_var->addAttribute(1, Attribute::NoCapture);
+	access->addAttribute(1, Attribute::NoCapture);
+
+	// variants are converted by reference, and self and other are instances
+	// access's var can be null, since lookup has no other instance access yet
+	to_real->addAttribute(1, Attribute::NonNull);
+	to_string->addAttribute(1, Attribute::NonNull);
+	lookup->addAttribute(1, Attribute::NonNull);
+	lookup->addAttribute(2, Attribute::NonNull);
+	lookup_default->addAttribute(1, Attribute::NonNull);
+	lookup_default->addAttribute(2, Attribute::NonNull);
+
+	// errors exit instead of returning null. interning adds the literal it's
+	// passed to the pool, so it's neither readonly nor free of captures
+	to_string->addAttribute(AttributeSet::ReturnIndex, Attribute::NonNull);
+	intern->addAttribute(AttributeSet::ReturnIndex, Attribute::NonNull);
+	access->addAttribute(AttributeSet::ReturnIndex, Attribute::NonNull);
+
+	// each lookup site's cache is its own. lookups may keep the name, but
+	// never the cache
+	lookup->addAttribute(lookup->arg_size(), Attribute::NoAlias);
+	lookup->addAttribute(lookup->arg_size(), Attribute::NoCapture);
+	lookup_default->addAttribute(lookup_default->arg_size(), Attribute::NoAlias);
+	lookup_default->addAttribute(lookup_default->arg_size(), Attribute::NoCapture);
+
 	// todo: implement these
 	/*with_begin = Function::Create(
 		runtime.getFunction("with_begin")->getFunctionType(),
@@ -82,6 +161,109 @@ node_codegen::node_codegen(const Module &runtime, error_stream &e) :
 }
 
 namespace {
+	StringRef name_ref(const identifier *name) {
+		return StringRef(name->data, name->length);
+	}
+
+	// runtime functions implementing each operator
+	const char *unary_name(token_type op) {
+		switch (op) {
+		default: return 0;
+		case exclaim: return "not_"; // get around c
+		case tilde: return "inv";
+		case minus: return "neg";
+		case plus: return "pos";
+		}
+	}
+
+	const char *binary_name(token_type op) {
+		switch (op) {
+		default: return 0;
+
+		case less: return "less";
+		case less_equals: return "less_equals";
+		case is_equals: return "is_equals";
+		case not_equals: return "not_equals";
+		case greater_equals: return "greater_equals";
+		case greater: return "greater";
+
+		case plus: return "plus";
+		case minus: return "minus";
+		case times: return "times";
+		case divide: return "divide";
+
+		case ampamp: return "log_and";
+		case pipepipe: return "log_or";
+		case caretcaret: return "log_xor";
+
+		case bit_and: return "bit_and";
+		case bit_or: return "bit_or";
+		case bit_xor: return "bit_xor";
+		case shift_left: return "shift_left";
+		case shift_right: return "shift_right";
+
+		case kw_div: return "div_"; // get around c
+		case kw_mod: return "mod";
+		}
+	}
+
+	// the value of a constant the folder leaves behind, if it's a real
+	bool constant_real(expression *e, double &real) {
+		if (e->type != value_node) return false;
+
+		token &t = static_cast<value*>(e)->t;
+		switch (t.type) {
+		default: return false;
+
+		case v_real: real = t.real; return true;
+		case kw_self: real = -1; return true;
+		case kw_other: real = -2; return true;
+		case kw_all: real = -3; return true;
+		case kw_noone: real = -4; return true;
+		case kw_global: real = -5; return true;
+		case kw_local: real = -6; return true;
+		case kw_true: real = 1; return true;
+		case kw_false: real = 0; return true;
+		}
+	}
+
+	// reals that convert exactly to and from an int64
+	bool is_integer(double real) {
+		return real == std::floor(real) && std::fabs(real) <= 9007199254740992.0;
+	}
+
+	// finds the case labels belonging to a switch, but not to nested switches
+	struct case_collector : public node_visitor<case_collector> {
+		case_collector(std::vector<casestatement*> &labels) : labels(labels) {}
+
+		void collect(statement *s) { if (s) visit(s); }
+
+		void visit_block(block *b) {
+			for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it)
+				collect(*it);
+		}
+
+		void visit_ifstatement(ifstatement *i) {
+			collect(i->branch_true);
+			collect(i->branch_false);
+		}
+		void visit_whilestatement(whilestatement *w) { collect(w->stmt); }
+		void visit_dostatement(dostatement *d) { collect(d->stmt); }
+		void visit_repeatstatement(repeatstatement *r) { collect(r->stmt); }
+		void visit_forstatement(forstatement *f) {
+			collect(f->init);
+			collect(f->stmt);
+			collect(f->inc);
+		}
+		void visit_withstatement(withstatement *w) { collect(w->stmt); }
+
+		void visit_casestatement(casestatement *c) {
+			if (c->expr) labels.push_back(c);
+		}
+
+		std::vector<casestatement*> &labels;
+	};
+
 	template <typename... types>
 	class save_context {
 	public:
@@ -95,7 +277,8 @@ namespace {
 }
 
 Function *node_codegen::add_function(
-	node *body, const char *name, size_t nargs, bool var
+	node *body, const char *name, size_t nargs, bool var,
+	const instance_layout *self
 ) {
 	Function *function = get_function(name, nargs, var);
 	if (!function->empty()) {
@@ -106,12 +289,24 @@ Function *node_codegen::add_function(
 	// this is not reentrant. it would need to save the state of:
 	// return, scopes, insertion point, and symbol table
 	Function::arg_iterator ai = function->arg_begin();
-	self_scope = ai;
+	self_scope = function_self = ai;
 	other_scope = ++ai;
 
+	self_slots.clear();
+	if (self) {
+		for (unsigned i = 0; i < self->size(); i++) {
+			const std::string &name = (*self)[i];
+			self_slots[names.intern(name.data(), name.size())] = i;
+		}
+	}
+
 	BasicBlock *entry = BasicBlock::Create(function->getContext());
 
 	scope.clear();
+	scalars.clear();
+	reals.clear();
+	types.infer(body);
+
 	alloca_point = new BitCastInst(
 		builder.getInt32(0), builder.getInt32Ty(), "alloca", entry
 	);
@@ -125,30 +320,62 @@ Function *node_codegen::add_function(
 		Value *arg_count = ++ai;
 		Value *arg_array = ++ai;
 
-		scope["argument_count"] = make_local("argument_count", get_real(
+		scope[argument_count_name] = make_local("argument_count", get_real(
 			builder.CreateUIToFP(arg_count, builder.getDoubleTy())
 		));
-		scope["argument"] = make_local(
+		scope[argument_name] = make_local(
 			"argument", arg_count, builder.getInt16(1), arg_array
 		);
 
-		// todo: accessors for argument# (also for builtin locals)
+		// argument# have no fixed address here, so get_argument reads them
+		// from the array through access, the same way argument[#] does
+	}
+	else {
+		// fixed arity functions take their arguments as parameters. argument#
+		// are the elements of the argument array, so the two alias
+		Value *arg_array = alloc(
+			variant_type, builder.getInt32(nargs), "argument"
+		);
+		for (size_t i = 0; i < nargs; i++) {
+			Value *tag = ++ai;
+			Value *payload = ++ai;
+			Value *arg = builder.CreateInsertValue(
+				UndefValue::get(ret_type), tag, 0
+			);
+			arg = builder.CreateInsertValue(arg, payload, 1);
+
+			Value *indices[] = { builder.getInt32(i) };
+			Value *element = builder.CreateInBoundsGEP(arg_array, indices);
+			store_variant(element, arg);
+
+			// released with the other scalars, balancing the retain below
+			if (i < max_arguments) scalars[argument_names[i]] = element;
+		}
+
+		scope[argument_count_name] = make_local("argument_count", get_real(
+			ConstantFP::get(real_type, nargs)
+		));
+		scope[argument_name] = make_local(
+			"argument", builder.getInt16(nargs), builder.getInt16(1), arg_array
+		);
 	}
 
-	visit(body);
+	if (!use_ir || !build_ir(body)) visit(body);
 
 	for (
-		std::unordered_map<std::string, Value*>::iterator it = scope.begin();
+		std::unordered_map<const identifier*, Value*>::iterator it = scope.begin();
 		it != scope.end(); ++it
 	) {
-		if (it->first == "argument_count" || it->first == "argument")
+		if (it->first == argument_count_name || it->first == argument_name)
 			continue;
 
 		builder.CreateCall(release_var, it->second);
 	}
+	for (auto &scalar : scalars) {
+		builder.CreateCall(release, scalar.second);
+	}
 
-	Value *ret = builder.CreateLoad(builder.CreateBitCast(return_value, ret_type->getPointerTo()));
-	builder.CreateRet(ret);
+	builder.CreateRet(load_variant(return_value));
 
 	return function;
 }
@@ -158,24 +385,26 @@ Value *node_codegen::visit_value(value *v) {
 	default: return 0;
 
 	case v_name: {
-		std::string name(v->t.string.data, v->t.string.length);
-		Value *var = scope.find(name) != scope.end() ? scope[name] :
-			do_lookup_default(
-				builder.CreateCall(
-					to_string,
-					get_string(StringRef(v->t.string.data, v->t.string.length))
-				),
-				lvalue
-			);
-		return builder.CreateCall4(
-			access, var,
-			builder.getInt16(0), builder.getInt16(0), builder.getInt1(lvalue)
-		);
+		auto real = reals.find(v->t.name);
+		if (real != reals.end()) return get_real(builder.CreateLoad(real->second));
+
+		auto scalar = scalars.find(v->t.name);
+		if (scalar != scalars.end()) return scalar->second;
+
+		auto local = scope.find(v->t.name);
+		Value *var = local != scope.end() ? local->second : 0;
+		if (!var) {
+			Value *argument = get_argument(v->t.name);
+			if (argument) return argument;
+		}
+		if (!var) var = get_self_slot(v->t.name);
+		if (!var) var = do_lookup_default(v->t.name, lvalue);
+		return do_access(var, builder.getInt16(0), builder.getInt16(0), lvalue);
 	}
 
 	case v_real: return get_real(v->t.real);
 	case v_string:
-		return get_string(StringRef(v->t.string.data, v->t.string.length));
+		return get_string(StringRef(v->t.data, v->t.length));
 
 	case kw_self: return get_real(-1);
 	case kw_other: return get_real(-2);
@@ -190,189 +419,156 @@ Value *node_codegen::visit_value(value *v) {
 }
 
 Value *node_codegen::visit_unary(unary *u) {
-	const char *name;
-	switch (u->op) {
-	default: return 0;
-	case exclaim: name = "not_"; break; // get around c
-	case tilde: name = "inv"; break;
-	case minus: name = "neg"; break;
-	case plus: name = "pos"; break;
-	}
-
-	Value *result = alloc(variant_type);
-	Value *operand = alloc(variant_type);
-	builder.CreateMemCpy(operand, visit(u->right), dl.getTypeStoreSize(variant_type), 0);
+	if (!unary_name(u->op)) return 0;
 
-	CallInst *call = builder.CreateCall(get_operator(name, 1), operand);
-	Value *ret = builder.CreateBitCast(result, ret_type->getPointerTo());
-	builder.CreateStore(call, ret);
-	return result;
+	if (types.type_of(u->right) == type_real) return get_real(real_value(u));
+	return operator_value(u->op, u->right, 0, false);
 }
 
 Value *node_codegen::visit_binary(binary *b) {
-	const char *name;
-	switch (b->op) {
-	default: return 0;
-
-	case dot: {
+	if (b->op == dot) {
 		token &name = static_cast<value*>(b->right)->t;
-		Value *var = do_lookup(
-			builder.CreateCall(to_real, visit(b->left)),
-			builder.CreateCall(
-				to_string,
-				get_string(StringRef(name.string.data, name.string.length))
-			),
+		Value *var = get_global_slot(b->left, name.name);
+		if (!var) var = do_lookup(
+			as_real(b->left),
+			builder.CreateCall(to_string, get_string(name_ref(name.name))),
 			lvalue
 		);
-		return builder.CreateCall4(
-			access, var,
-			builder.getInt16(0), builder.getInt16(0), builder.getInt1(lvalue)
-		);
+		return do_access(var, builder.getInt16(0), builder.getInt16(0), lvalue);
 	}
 
-	// todo: can we pull this out of a table instead of copypasting?
-	case less: name = "less"; break;
-	case less_equals: name = "less_equals"; break;
-	case is_equals: name = "is_equals"; break;
-	case not_equals: name = "not_equals"; break;
-	case greater_equals: name = "greater_equals"; break;
-	case greater: name = "greater"; break;
+	if (!binary_name(b->op)) return 0;
+	if (b->op == ampamp || b->op == pipepipe) return get_real(logical_value(b));
 
-	case plus: name = "plus"; break;
-	case minus: name = "minus"; break;
-	case times: name = "times"; break;
-	case divide: name = "divide"; break;
+	if (
+		types.type_of(b->left) == type_real &&
+		types.type_of(b->right) == type_real
+	)
+		return get_real(real_value(b));
 
-	case ampamp: name = "log_and"; break;
-	case pipepipe: name = "log_or"; break;
-	case caretcaret: name = "log_xor"; break;
-
-	case bit_and: name = "bit_and"; break;
-	case bit_or: name = "bit_or"; break;
-	case bit_xor: name = "bit_xor"; break;
-	case shift_left: name = "shift_left"; break;
-	case shift_right: name = "shift_right"; break;
-
-	case kw_div: name = "div_"; break; // get around c
-	case kw_mod: name = "mod"; break;
-	}
-
-	Value *left = alloc(variant_type);
-	Value *right = alloc(variant_type);
-	Value *result = alloc(variant_type);
-	builder.CreateMemCpy(left, visit(b->left), dl.getTypeStoreSize(variant_type), 0);
-	builder.CreateMemCpy(right, visit(b->right), dl.getTypeStoreSize(variant_type), 0);
-
-	CallInst *call = builder.CreateCall2(get_operator(name, 2), left, right);
-	Value *ret = builder.CreateBitCast(result, ret_type->getPointerTo());
-	builder.CreateStore(call, ret);
-	return result;
+	return operator_value(b->op, b->left, b->right, false);
 }
 
+// the indices can call scripts that add variables to an instance and move its
+// slots, so the variable is only found after they run. the instance on the
+// left of a dot is still evaluated before them
 Value *node_codegen::visit_subscript(subscript *s) {
-	Value *var;
-	switch (s->array->type) {
-	default: return 0;
+	if (s->array->type != value_node && s->array->type != binary_node) return 0;
 
-	case value_node: {
-		value *v = static_cast<value*>(s->array);
-		std::string name(v->t.string.data, v->t.string.length);
-		var = scope.find(name) != scope.end() ? scope[name] : do_lookup_default(
-			builder.CreateCall(
-				to_string,
-				get_string(StringRef(v->t.string.data, v->t.string.length))
-			),
-			lvalue
+	Value *instance = 0;
+	if (s->array->type == binary_node)
+		instance = as_real(static_cast<binary*>(s->array)->left);
+
+	std::vector<Value*> indices(2, builder.getInt16(0));
+	for (size_t i = 0; i < s->indices.size(); i++) {
+		Value *index = builder.CreateFPToUI(
+			as_real(s->indices[i]), builder.getInt16Ty()
 		);
-		break;
+		indices[i] = index;
 	}
 
-	case binary_node: {
+	Value *var;
+	if (s->array->type == value_node) {
+		value *v = static_cast<value*>(s->array);
+		auto local = scope.find(v->t.name);
+		var = local != scope.end() ? local->second : 0;
+		if (!var) var = get_self_slot(v->t.name);
+		if (!var) var = do_lookup_default(v->t.name, lvalue);
+	}
+	else {
 		binary *left = static_cast<binary*>(s->array);
 		token &name = static_cast<value*>(left->right)->t;
-		var = do_lookup(
-			builder.CreateCall(to_real, visit(left->left)),
-			builder.CreateCall(
-				to_string,
-				get_string(StringRef(name.string.data, name.string.length))
-			),
+		var = get_global_slot(left->left, name.name);
+		if (!var) var = do_lookup(
+			instance,
+			builder.CreateCall(to_string, get_string(name_ref(name.name))),
 			lvalue
 		);
-		break;
-	}
-	}
-
-	std::vector<Value*> indices(2, builder.getInt16(0));
-	for (size_t i = 0; i < s->indices.size(); i++) {
-		Value *index = builder.CreateFPToUI(
-			builder.CreateCall(to_real, visit(s->indices[i])),
-			builder.getInt16Ty()
-		);
-		indices[i] = index;
 	}
 
-	return builder.CreateCall4(
-		access, var, indices[0], indices[1], builder.getInt1(lvalue)
-	);
+	return do_access(var, indices[0], indices[1], lvalue);
 }
 
 Value *node_codegen::visit_call(call *c) {
-	StringRef name(c->function->t.string.data, c->function->t.string.length);
-	bool var = scripts.find(name) != scripts.end();
+	std::vector<Value*> args;
+	args.reserve(c->args.size());
+	for (size_t i = 0; i < c->args.size(); i++) {
+		args.push_back(load_variant(visit(c->args[i])));
+	}
+
+	const identifier *id = c->function->t.name;
+	Value *result = alloc(variant_type, name_ref(id) + "_ret");
+	store_variant(result, call_function(id, args));
+	return result;
+}
 
-	Function *function = get_function(name, var ? 0 : c->args.size(), var);
+// calls a function with each argument as a tag and payload pair
+Value *node_codegen::call_function(const identifier *id, ArrayRef<Value*> args) {
+	StringRef name = name_ref(id);
+	bool var = scripts.find(id) != scripts.end();
 
-	std::vector<Value*> args;
-	args.reserve(c->args.size() + 4);
+	Function *function;
+	if (var && args.size() <= max_arguments) {
+		var = false;
+		function = get_function(clone_name(name, args.size()), args.size(), false);
+	}
+	else function = get_function(id, var ? 0 : args.size(), var);
 
-	// todo: make & use new GML LLVM cc
-	Value *result = alloc(variant_type, name + "_ret");
+	std::vector<Value*> call_args;
+	call_args.reserve(2 * args.size() + 4);
 
-	args.push_back(self_scope);
-	args.push_back(other_scope);
-	if (var) args.push_back(builder.getInt16(c->args.size()));
+	call_args.push_back(self_scope);
+	call_args.push_back(other_scope);
 
-	Value *array = alloc(
-		variant_type, builder.getInt32(c->args.size()), name + "_args"
-	);
-	for (size_t i = 0; i < c->args.size(); i++) {
-		Value *indices[] = { builder.getInt32(i) };
-		Value *arg = builder.CreateInBoundsGEP(array, indices);
-		builder.CreateMemCpy(
-			arg, visit(c->args[i]), dl.getTypeStoreSize(variant_type), 0
+	// scripts index their arguments, so they still get an array
+	if (var) {
+		Value *array = alloc(
+			variant_type, builder.getInt32(args.size()), name + "_args"
 		);
+		for (size_t i = 0; i < args.size(); i++) {
+			Value *indices[] = { builder.getInt32(i) };
+			store_variant(builder.CreateInBoundsGEP(array, indices), args[i]);
+		}
 
-		if (!var) args.push_back(arg);
+		call_args.push_back(builder.getInt16(args.size()));
+		call_args.push_back(array);
+	}
+	else {
+		for (Value *arg : args) {
+			call_args.push_back(builder.CreateExtractValue(arg, 0));
+			call_args.push_back(builder.CreateExtractValue(arg, 1));
+		}
 	}
-	if (var) args.push_back(array);
 
-	CallInst *call = builder.CreateCall(function, args);
-	Value *ret = builder.CreateBitCast(result, ret_type->getPointerTo());
-	builder.CreateStore(call, ret);
-	return result;
+	return builder.CreateCall(function, call_args);
 }
 
 Value *node_codegen::visit_assignment(assignment *a) {
-	Value *r;
-	if (a->op == equals) {
-		r = visit(a->rvalue);
+	token_type op = unexpected;
+	switch (a->op) {
+	case plus_equals: op = plus; break;
+	case minus_equals: op = minus; break;
+	case times_equals: op = times; break;
+	case div_equals: op = divide; break;
+	case and_equals: op = bit_and; break;
+	case or_equals: op = bit_or; break;
+	case xor_equals: op = bit_xor; break;
+	default: /* should've already errored */ break;
 	}
-	else {
-		token_type op = unexpected;
-		switch (a->op) {
-		case plus_equals: op = plus; break;
-		case minus_equals: op = minus; break;
-		case times_equals: op = times; break;
-		case div_equals: op = divide; break;
-		case and_equals: op = bit_and; break;
-		case or_equals: op = bit_or; break;
-		case xor_equals: op = bit_xor; break;
-		default: /* should've already errored */ break;
+	binary b(op, a->lvalue, a->rvalue);
+
+	// real locals are stored unboxed, and inference made sure the value is real
+	if (a->lvalue->type == value_node) {
+		auto real = reals.find(static_cast<value*>(a->lvalue)->t.name);
+		if (real != reals.end()) {
+			Value *r = real_value(a->op == equals ? a->rvalue : &b);
+			builder.CreateStore(r, real->second);
+			return 0;
 		}
-		binary b(op, a->lvalue, a->rvalue);
-		r = visit_binary(&b);
 	}
 
+	Value *r = a->op == equals ? visit(a->rvalue) : visit_binary(&b);
+
 	Value *l;
 	{
 		save_context<bool> save(lvalue);
@@ -393,13 +589,14 @@ Value *node_codegen::visit_invocation(invocation* i) {
 
 Value *node_codegen::visit_declaration(declaration *d) {
 	for (
-		std::vector<value*>::iterator it = d->names.begin();
+		value **it = d->names.begin();
 		it != d->names.end(); ++it
 	) {
-		std::string name((*it)->t.string.data, (*it)->t.string.length);
+		const identifier *id = (*it)->t.name;
+		StringRef name = name_ref(id);
 
-		if (name == "argument" || name == "argument_count") {
-			errors.error(redefinition_error(name));
+		if (id == argument_name || id == argument_count_name) {
+			errors.error(redefinition_error(name.str()));
 			continue;
 		}
 		if (d->type.type == kw_globalvar) {
@@ -410,11 +607,33 @@ Value *node_codegen::visit_declaration(declaration *d) {
 			continue;
 		}
 
-		if (scope.find(name) != scope.end()) {
-			builder.CreateCall(release_var, scope[name]);
+		if (types.is_real(id)) {
+			Value *&real = reals[id];
+			if (!real) real = alloc(real_type, name);
+			continue;
+		}
+
+		// a redeclared scalar's old value is released when it's next assigned
+		if (types.is_scalar(id)) {
+			Value *&scalar = scalars[id];
+			if (!scalar) {
+				scalar = alloc(variant_type, name);
+
+				// it's released at the end even if this declaration never runs
+				IRBuilder<>::InsertPoint ip = builder.saveIP();
+				builder.SetInsertPoint(alloca_point);
+				store_real(scalar, ConstantFP::get(real_type, 0));
+				builder.restoreIP(ip);
+			}
+			continue;
+		}
+
+		Value *&local = scope[id];
+		if (local) {
+			builder.CreateCall(release_var, local);
 		}
 
-		scope[name] = make_local(
+		local = make_local(
 			name, Constant::getNullValue(variant_type->getPointerTo())
 		);
 	}
@@ -423,7 +642,7 @@ Value *node_codegen::visit_declaration(declaration *d) {
 }
 
 Value *node_codegen::visit_block(block *b) {
-	for (std::vector<statement*>::iterator it = b->stmts.begin(); it != b->stmts.end(); ++it) {
+	for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it) {
 		visit(*it);
 	}
 
@@ -436,7 +655,7 @@ Value *node_codegen::visit_ifstatement(ifstatement *i) {
 	BasicBlock *branch_false = BasicBlock::Create(f->getContext(), "else");
 	BasicBlock *merge = BasicBlock::Create(f->getContext(), "merge");
 
-	builder.CreateCondBr(to_bool(i->cond), branch_true, branch_false);
+	branch(i->cond, branch_true, branch_false);
 
 	f->getBasicBlockList().push_back(branch_true);
 	builder.SetInsertPoint(branch_true);
@@ -465,7 +684,7 @@ Value *node_codegen::visit_whilestatement(whilestatement *w) {
 
 	f->getBasicBlockList().push_back(cond);
 	builder.SetInsertPoint(cond);
-	builder.CreateCondBr(to_bool(w->cond), loop, after);
+	branch(w->cond, loop, after);
 
 	f->getBasicBlockList().push_back(loop);
 	builder.SetInsertPoint(loop);
@@ -503,7 +722,7 @@ Value *node_codegen::visit_dostatement(dostatement *d) {
 
 	f->getBasicBlockList().push_back(cond);
 	builder.SetInsertPoint(cond);
-	builder.CreateCondBr(to_bool(d->cond), after, loop);
+	branch(d->cond, after, loop);
 
 	f->getBasicBlockList().push_back(after);
 	builder.SetInsertPoint(after);
@@ -511,34 +730,42 @@ Value *node_codegen::visit_dostatement(dostatement *d) {
 	return 0;
 }
 
+// the count is tested before each iteration, so repeat (0) runs nothing
 Value *node_codegen::visit_repeatstatement(repeatstatement *r) {
 	Function *f = builder.GetInsertBlock()->getParent();
+	BasicBlock *cond = BasicBlock::Create(f->getContext(), "cond");
 	BasicBlock *loop = BasicBlock::Create(f->getContext(), "loop");
+	BasicBlock *next = BasicBlock::Create(f->getContext(), "next");
 	BasicBlock *after = BasicBlock::Create(f->getContext(), "after");
 	BasicBlock *init = builder.GetInsertBlock();
 
 	Value *start = ConstantFP::get(builder.getDoubleTy(), 0);
-	Value *end = builder.CreateCall(to_real, visit(r->expr));
-	builder.CreateBr(loop);
+	Value *end = as_real(r->expr);
+	builder.CreateBr(cond);
+
+	f->getBasicBlockList().push_back(cond);
+	builder.SetInsertPoint(cond);
+	PHINode *count = builder.CreatePHI(builder.getDoubleTy(), 2, "count");
+	count->addIncoming(start, init);
+
+	// todo: check with GM's rounding behavior
+	builder.CreateCondBr(builder.CreateFCmpULT(count, end), loop, after);
 
 	f->getBasicBlockList().push_back(loop);
 	builder.SetInsertPoint(loop);
-	PHINode *inc = builder.CreatePHI(builder.getDoubleTy(), 2, "inc");
 	{
-		inc->addIncoming(start, init);
-
 		save_context<BasicBlock*, BasicBlock*> save(current_loop, current_end);
-		current_loop = loop;
+		current_loop = next;
 		current_end = after;
 		visit(r->stmt);
-
-		Value *next = builder.CreateFAdd(inc, ConstantFP::get(builder.getDoubleTy(), 1));
-		BasicBlock *last = builder.GetInsertBlock();
-		inc->addIncoming(next, last);
 	}
-	// todo: check with GM's rounding behavior
-	Value *done = builder.CreateFCmpULT(inc, end);
-	builder.CreateCondBr(done, loop, after);
+	builder.CreateBr(next);
+
+	f->getBasicBlockList().push_back(next);
+	builder.SetInsertPoint(next);
+	Value *inc = builder.CreateFAdd(count, ConstantFP::get(builder.getDoubleTy(), 1));
+	count->addIncoming(inc, next);
+	builder.CreateBr(cond);
 
 	f->getBasicBlockList().push_back(after);
 	builder.SetInsertPoint(after);
@@ -558,7 +785,7 @@ Value *node_codegen::visit_forstatement(forstatement *f) {
 
 	fn->getBasicBlockList().push_back(cond);
 	builder.SetInsertPoint(cond);
-	builder.CreateCondBr(to_bool(f->cond), loop, after);
+	branch(f->cond, loop, after);
 
 	fn->getBasicBlockList().push_back(loop);
 	builder.SetInsertPoint(loop);
@@ -629,7 +856,6 @@ Value *node_codegen::visit_withstatement(withstatement *w) {
 	return 0;
 }
 
-// todo: switch on a hash rather than generating an if/else chain
 Value *node_codegen::visit_switchstatement(switchstatement *s) {
 	Function *f = builder.GetInsertBlock()->getParent();
 	BasicBlock *switch_default = BasicBlock::Create(f->getContext(), "default");
@@ -637,22 +863,35 @@ Value *node_codegen::visit_switchstatement(switchstatement *s) {
 	BasicBlock *after = BasicBlock::Create(f->getContext(), "after");
 
 	Value *switch_expr = visit(s->expr);
+
+	std::vector<casestatement*> labels;
+	case_collector(labels).collect(s->stmts);
+
+	std::unordered_map<casestatement*, BasicBlock*> cases;
+	bool lowered = lower_switch(switch_expr, labels, switch_default, cases);
 	Function::iterator switch_cond = builder.GetInsertBlock();
 
 	f->getBasicBlockList().push_back(dead);
 	builder.SetInsertPoint(dead);
 	{
-		save_context<Value*, BasicBlock*, Function::iterator, BasicBlock*> save(
-			current_switch, current_default, current_cond, current_end
+		save_context<
+			Value*, BasicBlock*, Function::iterator, BasicBlock*,
+			std::unordered_map<casestatement*, BasicBlock*>*
+		> save(
+			current_switch, current_default, current_cond, current_end,
+			current_cases
 		);
 		current_switch = switch_expr;
 		current_default = switch_default;
 		current_cond = switch_cond;
 		current_end = after;
+		current_cases = lowered ? &cases : 0;
 		visit(s->stmts);
 
-		builder.SetInsertPoint(current_cond);
-		builder.CreateBr(current_default);
+		if (!lowered) {
+			builder.SetInsertPoint(current_cond);
+			builder.CreateBr(current_default);
+		}
 
 		builder.SetInsertPoint(&f->getBasicBlockList().back());
 		if (!current_default->getParent()) {
@@ -670,6 +909,120 @@ Value *node_codegen::visit_switchstatement(switchstatement *s) {
 	return 0;
 }
 
+// switches whose cases are all integers or all strings jump straight to the
+// matching case, rather than comparing the value against each one in turn
+// integers use an llvm switch, and strings switch on their hash before
+// comparing pointers, since both sides are interned
+bool node_codegen::lower_switch(
+	Value *switch_expr, const std::vector<casestatement*> &labels,
+	BasicBlock *switch_default,
+	std::unordered_map<casestatement*, BasicBlock*> &cases
+) {
+	if (labels.empty()) return false;
+
+	bool integers = true, strings = true;
+	double real;
+	for (casestatement *c : labels) {
+		integers = integers && constant_real(c->expr, real) && is_integer(real);
+		strings = strings &&
+			c->expr->type == value_node &&
+			static_cast<value*>(c->expr)->t.type == v_string;
+	}
+	if (!integers && !strings) return false;
+
+	Function *f = builder.GetInsertBlock()->getParent();
+	for (casestatement *c : labels) {
+		cases[c] = BasicBlock::Create(f->getContext(), "case");
+	}
+
+	if (integers) {
+		BasicBlock *range = BasicBlock::Create(f->getContext(), "range", f);
+		BasicBlock *exact = BasicBlock::Create(f->getContext(), "exact", f);
+		BasicBlock *dispatch = BasicBlock::Create(f->getContext(), "dispatch", f);
+
+		double min = INFINITY, max = -INFINITY;
+		for (casestatement *c : labels) {
+			constant_real(c->expr, real);
+			min = std::min(min, real);
+			max = std::max(max, real);
+		}
+
+		builder.CreateCondBr(is_real(switch_expr), range, switch_default);
+
+		// the conversion to an integer is only defined in range
+		builder.SetInsertPoint(range);
+		Value *val = load_real(switch_expr);
+		Value *in_range = builder.CreateAnd(
+			builder.CreateFCmpOGE(val, ConstantFP::get(real_type, min)),
+			builder.CreateFCmpOLE(val, ConstantFP::get(real_type, max))
+		);
+		builder.CreateCondBr(in_range, exact, switch_default);
+
+		builder.SetInsertPoint(exact);
+		Value *index = builder.CreateFPToSI(val, builder.getInt64Ty());
+		Value *is_exact = builder.CreateFCmpOEQ(
+			builder.CreateSIToFP(index, real_type), val
+		);
+		builder.CreateCondBr(is_exact, dispatch, switch_default);
+
+		// the first of any duplicate cases is the one that matches
+		builder.SetInsertPoint(dispatch);
+		SwitchInst *sw = builder.CreateSwitch(index, switch_default, labels.size());
+		std::unordered_set<int64_t> seen;
+		for (casestatement *c : labels) {
+			constant_real(c->expr, real);
+			if (seen.insert((int64_t)real).second)
+				sw->addCase(builder.getInt64((int64_t)real), cases[c]);
+		}
+
+		return true;
+	}
+
+	BasicBlock *str = BasicBlock::Create(f->getContext(), "string", f);
+	builder.CreateCondBr(is_string(switch_expr), str, switch_default);
+
+	builder.SetInsertPoint(str);
+	Value *sindices[] = { builder.getInt32(0), builder.getInt32(1) };
+	LoadInst *val = builder.CreateLoad(builder.CreateBitCast(
+		builder.CreateInBoundsGEP(switch_expr, sindices),
+		string_type->getPointerTo()
+	));
+	val->setMetadata(LLVMContext::MD_tbaa, payload_tbaa);
+	Value *hindices[] = { builder.getInt32(0), builder.getInt32(2) };
+	Value *hash = builder.CreateLoad(builder.CreateInBoundsGEP(val, hindices));
+
+	// cases are grouped by hash, in case two of them collide
+	std::map<size_t, std::vector<casestatement*>> hashes;
+	for (casestatement *c : labels) {
+		token &t = static_cast<value*>(c->expr)->t;
+		hashes[string::compute_hash(t.length, t.data)].push_back(c);
+	}
+
+	Type *size_type = builder.getIntPtrTy(&dl);
+	SwitchInst *sw = builder.CreateSwitch(hash, switch_default, hashes.size());
+	for (auto &h : hashes) {
+		BasicBlock *compare = BasicBlock::Create(f->getContext(), "compare", f);
+		sw->addCase(cast<ConstantInt>(ConstantInt::get(size_type, h.first)), compare);
+
+		builder.SetInsertPoint(compare);
+		std::vector<StringRef> seen;
+		for (casestatement *c : h.second) {
+			token &t = static_cast<value*>(c->expr)->t;
+			StringRef name(t.data, t.length);
+			if (std::find(seen.begin(), seen.end(), name) != seen.end()) continue;
+			seen.push_back(name);
+
+			BasicBlock *next = BasicBlock::Create(f->getContext(), "compare", f);
+			Value *match = builder.CreateICmpEQ(val, intern_string(name));
+			builder.CreateCondBr(match, cases[c], next);
+			builder.SetInsertPoint(next);
+		}
+		builder.CreateBr(switch_default);
+	}
+
+	return true;
+}
+
 Value *node_codegen::visit_casestatement(casestatement *c) {
 	Function *f = builder.GetInsertBlock()->getParent();
 
@@ -681,6 +1034,16 @@ Value *node_codegen::visit_casestatement(casestatement *c) {
 		return 0;
 	}
 
+	if (current_cases) {
+		BasicBlock *switch_case = (*current_cases)[c];
+		builder.CreateBr(switch_case);
+
+		f->getBasicBlockList().push_back(switch_case);
+		builder.SetInsertPoint(switch_case);
+
+		return 0;
+	}
+
 	BasicBlock *switch_case = BasicBlock::Create(f->getContext(), "case");
 	BasicBlock *next_cond = BasicBlock::Create(f->getContext(), "next");
 
@@ -706,14 +1069,14 @@ Value *node_codegen::visit_jump(jump *j) {
 	switch (j->type) {
 	default: return 0;
 
-	case kw_exit: builder.CreateRet(builder.CreateLoad(return_value)); break;
+	case kw_exit: builder.CreateRet(load_variant(return_value)); break;
 	case kw_break:
 		if (current_end) builder.CreateBr(current_end);
-		else builder.CreateRet(builder.CreateLoad(return_value));
+		else builder.CreateRet(load_variant(return_value));
 		break;
 	case kw_continue:
 		if (current_loop) builder.CreateBr(current_loop);
-		else builder.CreateRet(builder.CreateLoad(return_value));
+		else builder.CreateRet(load_variant(return_value));
 		break;
 	}
 
@@ -725,9 +1088,7 @@ Value *node_codegen::visit_jump(jump *j) {
 }
 
 Value *node_codegen::visit_returnstatement(returnstatement *r) {
-	Value *ret = visit(r->expr);
-	Value *ptr = builder.CreateBitCast(ret, ret_type->getPointerTo());
-	builder.CreateRet(builder.CreateLoad(ptr));
+	builder.CreateRet(load_variant(visit(r->expr)));
 
 	Function *f = builder.GetInsertBlock()->getParent();
 	BasicBlock *cont = BasicBlock::Create(f->getContext(), "cont", f);
@@ -740,21 +1101,45 @@ Function *node_codegen::get_operator(StringRef name, int args) {
 	Function *function = module.getFunction(name);
 	if (function) return function;
 
-	return Function::Create(
+	function = Function::Create(
 		runtime.getFunction(name)->getFunctionType(),
 		Function::ExternalLinkage, name, &module
 	);
+	function->addFnAttr(Attribute::NoUnwind);
+
+	// operators only read their operands, which are always spilled first. they
+	// can report a type error, so they aren't readonly themselves
+	for (int n = 1; n <= args; n++) {
+		function->addAttribute(n, Attribute::ReadOnly);
+		function->addAttribute(n, Attribute::NoCapture);
+		function->addAttribute(n, Attribute::NonNull);
+	}
+
+	return function;
+}
+
+// calls look functions up by identifier first, to skip hashing the name
+Function *node_codegen::get_function(const identifier *name, int args, bool var) {
+	Function *&function = functions[name];
+	if (!function) function = get_function(name_ref(name), args, var);
+	return function;
 }
 
 Function *node_codegen::get_function(StringRef name, int args, bool var) {
 	Function *function = module.getFunction(name);
 	if (function) return function;
 
-	std::vector<Type*> vargs(
-		args + (var ? 4 : 2), variant_type->getPointerTo()
-	);
-	vargs[0] = vargs[1] = scope_type;
-	if (var) vargs[2] = builder.getInt16Ty();
+	// variants are passed and returned as a tag and payload pair, which is how
+	// the c abi passes them by value
+	std::vector<Type*> vargs(2, scope_type);
+	if (var) {
+		vargs.push_back(builder.getInt16Ty());
+		vargs.push_back(variant_type->getPointerTo());
+	}
+	else for (int i = 0; i < args; i++) {
+		vargs.push_back(ret_type->getElementType(0));
+		vargs.push_back(ret_type->getElementType(1));
+	}
 
 	FunctionType *type = FunctionType::get(ret_type, vargs, false);
 	function = Function::Create(type, Function::ExternalLinkage, name, &module);
@@ -778,41 +1163,39 @@ Value *node_codegen::get_real(double val) {
 		))
 	};
 	Constant *variant = ConstantStruct::getAnon(contents);
-	GlobalVariable *global = new GlobalVariable(
-		module, variant->getType(), true, GlobalValue::InternalLinkage, variant
-	);
-	global->setUnnamedAddr(true);
+
+	// constants are uniqued by llvm, so equal reals share a global
+	GlobalVariable *&global = real_constants[variant];
+	if (!global) {
+		global = new GlobalVariable(
+			module, variant->getType(), true, GlobalValue::InternalLinkage, variant
+		);
+		global->setUnnamedAddr(true);
+	}
 
 	return builder.CreateBitCast(global, variant_type->getPointerTo());
 }
 
 Value *node_codegen::get_real(Value *val) {
 	Value *variant = alloc(variant_type, "real");
-
-	Value *tindices[] = { builder.getInt32(0), builder.getInt32(0) };
-	Value *type = builder.CreateInBoundsGEP(variant, tindices);
-	builder.CreateStore(builder.getInt8(0), type);
-
-	Value *rindices[] = { builder.getInt32(0), builder.getInt32(1) };
-	Value *real = builder.CreateBitCast(
-		builder.CreateInBoundsGEP(variant, rindices),
-		builder.getDoubleTy()->getPointerTo()
-	);
-	builder.CreateStore(val, real);
-
+	store_real(variant, val);
 	return variant;
 }
 
-Value *node_codegen::get_string(StringRef val) {
-	GlobalVariable *literal;
-	if (string_literals.find(val) != string_literals.end()) {
-		literal = string_literals[val];
-	}
-	else {
+// the runtime's copy of a string literal
+// literals are interned once at startup, so each use is just a load
+Value *node_codegen::intern_string(StringRef val) {
+	return builder.CreateLoad(get_literal_slot(val));
+}
+
+GlobalVariable *node_codegen::get_literal_slot(StringRef val) {
+	GlobalVariable *&slot = string_literals[val];
+	if (!slot) {
 		Type *size_type = builder.getIntPtrTy(&dl);
 
+		// literals start out retained, so releasing them never frees a global
 		Constant *contents[] = {
-			ConstantInt::get(size_type, 0, false), // refcount
+			ConstantInt::get(size_type, 1, false), // refcount
 			ConstantPointerNull::get(builder.getInt8PtrTy()), // pool
 			ConstantInt::get( // hash
 				size_type, string::compute_hash(val.size(), val.data()), false
@@ -821,39 +1204,491 @@ Value *node_codegen::get_string(StringRef val) {
 			ConstantDataArray::getString(module.getContext(), val, false) // data
 		};
 		Constant *s = ConstantStruct::getAnon(contents);
-		literal = new GlobalVariable(
+		GlobalVariable *literal = new GlobalVariable(
 			module, s->getType(), false, GlobalValue::PrivateLinkage, s
 		);
-		string_literals[val] = literal;
+
+		slot = new GlobalVariable(
+			module, string_type, false, GlobalValue::InternalLinkage,
+			ConstantPointerNull::get(string_type), "string"
+		);
+
+		IRBuilder<> init(get_string_init()->getEntryBlock().getTerminator());
+		init.CreateStore(
+			init.CreateCall(intern, init.CreateBitCast(literal, string_type)), slot
+		);
+	}
+
+	return slot;
+}
+
+// the module's initializer, which runs after the runtime's string pool exists
+Function *node_codegen::get_string_init() {
+	if (string_init) return string_init;
+
+	string_init = Function::Create(
+		FunctionType::get(builder.getVoidTy(), false),
+		Function::InternalLinkage, "intern_strings", &module
+	);
+	BasicBlock *entry = BasicBlock::Create(module.getContext(), "", string_init);
+	ReturnInst::Create(module.getContext(), entry);
+
+	appendToGlobalCtors(module, string_init, 65535);
+	return string_init;
+}
+
+void node_codegen::register_globals(
+	const instance_layout &globals, const std::vector<std::string> &globalvars
+) {
+	for (unsigned i = 0; i < globals.size(); i++) {
+		const std::string &name = globals[i];
+		global_slots[names.intern(name.data(), name.size())] = i;
+	}
+	for (const std::string &name : globalvars) {
+		this->globalvars.insert(names.intern(name.data(), name.size()));
+	}
+
+	globals_registered = true;
+}
+
+// exports an object's layout for the runtime to build its instances from
+// the names are interned strings, so they're filled in at startup
+void node_codegen::add_layout(
+	const std::string &name, const instance_layout &layout
+) {
+	ArrayType *names_type = ArrayType::get(string_type, layout.size());
+	GlobalVariable *names = new GlobalVariable(
+		module, names_type, false, GlobalValue::InternalLinkage,
+		ConstantAggregateZero::get(names_type), "names"
+	);
+
+	for (size_t i = 0; i < layout.size(); i++) {
+		GlobalVariable *slot = get_literal_slot(layout[i]);
+
+		IRBuilder<> init(get_string_init()->getEntryBlock().getTerminator());
+		Value *indices[] = { init.getInt32(0), init.getInt32(i) };
+		init.CreateStore(
+			init.CreateLoad(slot), init.CreateInBoundsGEP(names, indices)
+		);
 	}
 
+	// the runtime adds transitions and an index to it as instances use it
+	Type *size_type = builder.getIntPtrTy(&dl);
+	Constant *contents[] = {
+		ConstantInt::get(size_type, layout.size()),
+		ConstantExpr::getBitCast(names, string_type->getPointerTo()),
+		ConstantPointerNull::get(
+			cast<PointerType>(layout_type->getElementType(2))
+		),
+		ConstantPointerNull::get(
+			cast<PointerType>(layout_type->getElementType(3))
+		)
+	};
+	new GlobalVariable(
+		module, layout_type, false, GlobalValue::ExternalLinkage,
+		ConstantStruct::get(layout_type, contents), name
+	);
+}
+
+Value *node_codegen::get_string(StringRef val) {
 	Value *variant = alloc(variant_type, "string");
 
 	Value *tindices[] = { builder.getInt32(0), builder.getInt32(0) };
 	Value *type = builder.CreateInBoundsGEP(variant, tindices);
-	builder.CreateStore(builder.getInt8(1), type);
+	builder.CreateStore(builder.getInt8(1), type)
+		->setMetadata(LLVMContext::MD_tbaa, tag_tbaa);
 
 	Value *sindices[] = { builder.getInt32(0), builder.getInt32(1) };
 	Value *string = builder.CreateBitCast(
 		builder.CreateInBoundsGEP(variant, sindices),
 		string_type->getPointerTo()
 	);
-	builder.CreateStore(builder.CreateCall(
-		intern, builder.CreateBitCast(literal, string_type)
-	), string);
+	builder.CreateStore(intern_string(val), string)
+		->setMetadata(LLVMContext::MD_tbaa, payload_tbaa);
 
 	return variant;
 }
 
-Value *node_codegen::to_bool(node *cond) {
-	Value *expr = builder.CreateCall(to_real, visit(cond));
-	return builder.CreateFCmpUGT(expr, ConstantFP::get(builder.getDoubleTy(), 0.5));
+// computes an expression that inference found to be real as a double
+Value *node_codegen::real_value(expression *e) {
+	switch (e->type) {
+	default: break;
+
+	case value_node: {
+		token &t = static_cast<value*>(e)->t;
+		switch (t.type) {
+		default: break;
+
+		case v_name: {
+			auto real = reals.find(t.name);
+			if (real != reals.end()) return builder.CreateLoad(real->second);
+			break;
+		}
+
+		case v_real: return ConstantFP::get(real_type, t.real);
+		case kw_self: return ConstantFP::get(real_type, -1);
+		case kw_other: return ConstantFP::get(real_type, -2);
+		case kw_all: return ConstantFP::get(real_type, -3);
+		case kw_noone: return ConstantFP::get(real_type, -4);
+		case kw_global: return ConstantFP::get(real_type, -5);
+		case kw_local: return ConstantFP::get(real_type, -6);
+		case kw_true: return ConstantFP::get(real_type, 1);
+		case kw_false: return ConstantFP::get(real_type, 0);
+		}
+		break;
+	}
+
+	case unary_node: {
+		unary *u = static_cast<unary*>(e);
+		if (types.type_of(u->right) == type_real)
+			return real_unary(u->op, real_value(u->right));
+		return operator_value(u->op, u->right, 0, true);
+	}
+
+	case binary_node: {
+		binary *b = static_cast<binary*>(e);
+		if (b->op == dot) break;
+		if (b->op == ampamp || b->op == pipepipe) return logical_value(b);
+
+		if (
+			types.type_of(b->left) == type_real &&
+			types.type_of(b->right) == type_real
+		)
+			return real_binary(b->op, real_value(b->left), real_value(b->right));
+		return operator_value(b->op, b->left, b->right, true);
+	}
+	}
+
+	return load_real(visit(e));
+}
+
+// these match the runtime's real operators
+Value *node_codegen::real_unary(token_type op, Value *a) {
+	Value *zero = ConstantFP::get(real_type, 0);
+	switch (op) {
+	default: return 0;
+
+	case exclaim:
+		return builder.CreateUIToFP(builder.CreateFCmpOEQ(a, zero), real_type);
+	case tilde:
+		return builder.CreateSIToFP(
+			builder.CreateNot(builder.CreateFPToSI(a, builder.getInt32Ty())),
+			real_type
+		);
+	case minus: return builder.CreateFNeg(a);
+	case plus: return a;
+	}
+}
+
+Value *node_codegen::real_binary(token_type op, Value *l, Value *r) {
+	Value *zero = ConstantFP::get(real_type, 0);
+	Type *int_type = builder.getInt32Ty();
+	switch (op) {
+	default: return 0;
+
+	case less:
+		return builder.CreateUIToFP(builder.CreateFCmpOLT(l, r), real_type);
+	case less_equals:
+		return builder.CreateUIToFP(builder.CreateFCmpOLE(l, r), real_type);
+	case is_equals:
+		return builder.CreateUIToFP(builder.CreateFCmpOEQ(l, r), real_type);
+	case not_equals:
+		return builder.CreateUIToFP(builder.CreateFCmpUNE(l, r), real_type);
+	case greater_equals:
+		return builder.CreateUIToFP(builder.CreateFCmpOGE(l, r), real_type);
+	case greater:
+		return builder.CreateUIToFP(builder.CreateFCmpOGT(l, r), real_type);
+
+	case plus: return builder.CreateFAdd(l, r);
+	case minus: return builder.CreateFSub(l, r);
+	case times: return builder.CreateFMul(l, r);
+	case divide: return builder.CreateFDiv(l, r);
+
+	// && and || branch instead, see logical_value
+	case caretcaret: {
+		Value *x = builder.CreateFCmpUNE(l, zero);
+		Value *y = builder.CreateFCmpUNE(r, zero);
+		return builder.CreateUIToFP(builder.CreateXor(x, y), real_type);
+	}
+
+	case bit_and: case bit_or: case bit_xor:
+	case shift_left: case shift_right: {
+		Value *x = builder.CreateFPToSI(l, int_type);
+		Value *y = builder.CreateFPToSI(r, int_type);
+		Value *result =
+			op == bit_and ? builder.CreateAnd(x, y) :
+			op == bit_or ? builder.CreateOr(x, y) :
+			op == bit_xor ? builder.CreateXor(x, y) :
+			op == shift_left ? builder.CreateShl(x, y) :
+			builder.CreateAShr(x, y);
+		return builder.CreateSIToFP(result, real_type);
+	}
+
+	case kw_div:
+		return builder.CreateSIToFP(
+			builder.CreateFPToSI(builder.CreateFDiv(l, r), int_type), real_type
+		);
+	case kw_mod: return builder.CreateFRem(l, r);
+	}
+}
+
+// applies an operator to operands of unknown type, with a unary if right is null
+// the tags are checked inline so reals skip the runtime, which only handles the
+// rest out of line. with to_double, the result is a double instead of a variant
+Value *node_codegen::operator_value(
+	token_type op, expression *left, expression *right, bool to_double
+) {
+	// the right operand may change the left one, so it's copied first
+	Value *l = visit(left);
+	if (right) {
+		Value *copy = alloc(variant_type);
+		builder.CreateMemCpy(copy, l, dl.getTypeStoreSize(variant_type), 0);
+		l = copy;
+	}
+	Value *r = right ? visit(right) : 0;
+
+	bool strings =
+		types.type_of(left) == type_string ||
+		(right && types.type_of(right) == type_string);
+	return operator_call(op, l, r, strings, to_double);
+}
+
+// the operator on variants that have already been evaluated, with the same
+// fast path. strings never take it
+Value *node_codegen::operator_call(
+	token_type op, Value *l, Value *r, bool strings, bool to_double
+) {
+	Function *function = r ?
+		get_operator(binary_name(op), 2) : get_operator(unary_name(op), 1);
+
+	Value *result = alloc(variant_type);
+
+	if (strings) {
+		CallInst *call = r ?
+			builder.CreateCall2(function, l, r) : builder.CreateCall(function, l);
+		store_variant(result, call);
+		return to_double ? builder.CreateCall(to_real, result) : result;
+	}
+
+	Function *f = builder.GetInsertBlock()->getParent();
+	BasicBlock *fast = BasicBlock::Create(f->getContext(), "real");
+	BasicBlock *slow = BasicBlock::Create(f->getContext(), "dispatch");
+	BasicBlock *merge = BasicBlock::Create(f->getContext(), "merge");
+
+	Value *reals = is_real(l);
+	if (r) reals = builder.CreateAnd(reals, is_real(r));
+	builder.CreateCondBr(reals, fast, slow, likely_real);
+
+	f->getBasicBlockList().push_back(fast);
+	builder.SetInsertPoint(fast);
+	Value *real = r ?
+		real_binary(op, load_real(l), load_real(r)) : real_unary(op, load_real(l));
+	if (!to_double) store_real(result, real);
+	builder.CreateBr(merge);
+
+	f->getBasicBlockList().push_back(slow);
+	builder.SetInsertPoint(slow);
+	CallInst *call = r ?
+		builder.CreateCall2(function, l, r) : builder.CreateCall(function, l);
+	call->addAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
+	store_variant(result, call);
+	Value *dispatched = to_double ? builder.CreateCall(to_real, result) : 0;
+	builder.CreateBr(merge);
+
+	f->getBasicBlockList().push_back(merge);
+	builder.SetInsertPoint(merge);
+	if (!to_double) return result;
+
+	PHINode *phi = builder.CreatePHI(real_type, 2);
+	phi->addIncoming(real, fast);
+	phi->addIncoming(dispatched, slow);
+	return phi;
+}
+
+// converts any expression to a double, without boxing it first if possible
+Value *node_codegen::as_real(expression *e) {
+	if (types.type_of(e) == type_real) return real_value(e);
+
+	switch (e->type) {
+	default: break;
+
+	case unary_node: {
+		unary *u = static_cast<unary*>(e);
+		if (!unary_name(u->op)) break;
+		return operator_value(u->op, u->right, 0, true);
+	}
+
+	case binary_node: {
+		binary *b = static_cast<binary*>(e);
+		if (b->op == dot || !binary_name(b->op)) break;
+		return operator_value(b->op, b->left, b->right, true);
+	}
+	}
+
+	return variant_real(visit(e));
+}
+
+// variables are usually reals, so to_real is only called for the rest
+Value *node_codegen::variant_real(Value *v) {
+	Function *f = builder.GetInsertBlock()->getParent();
+	BasicBlock *fast = BasicBlock::Create(f->getContext(), "real");
+	BasicBlock *slow = BasicBlock::Create(f->getContext(), "convert");
+	BasicBlock *merge = BasicBlock::Create(f->getContext(), "merge");
+
+	builder.CreateCondBr(is_real(v), fast, slow, likely_real);
+
+	f->getBasicBlockList().push_back(fast);
+	builder.SetInsertPoint(fast);
+	Value *real = load_real(v);
+	builder.CreateBr(merge);
+
+	f->getBasicBlockList().push_back(slow);
+	builder.SetInsertPoint(slow);
+	CallInst *converted = builder.CreateCall(to_real, v);
+	converted->addAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
+	builder.CreateBr(merge);
+
+	f->getBasicBlockList().push_back(merge);
+	builder.SetInsertPoint(merge);
+	PHINode *phi = builder.CreatePHI(real_type, 2);
+	phi->addIncoming(real, fast);
+	phi->addIncoming(converted, slow);
+	return phi;
+}
+
+Value *node_codegen::is_real(Value *variant) {
+	return builder.CreateICmpEQ(load_tag(variant), builder.getInt8(0));
+}
+
+Value *node_codegen::is_string(Value *variant) {
+	return builder.CreateICmpEQ(load_tag(variant), builder.getInt8(1));
+}
+
+Value *node_codegen::load_tag(Value *variant) {
+	Value *indices[] = { builder.getInt32(0), builder.getInt32(0) };
+	LoadInst *tag = builder.CreateLoad(builder.CreateInBoundsGEP(variant, indices));
+	tag->setMetadata(LLVMContext::MD_tbaa, tag_tbaa);
+	return tag;
+}
+
+Value *node_codegen::load_real(Value *variant) {
+	Value *indices[] = { builder.getInt32(0), builder.getInt32(1) };
+	Value *real = builder.CreateBitCast(
+		builder.CreateInBoundsGEP(variant, indices), real_type->getPointerTo()
+	);
+	LoadInst *load = builder.CreateLoad(real);
+	load->setMetadata(LLVMContext::MD_tbaa, payload_tbaa);
+	return load;
+}
+
+// a whole variant as the tag and payload pair it's passed around in
+Value *node_codegen::load_variant(Value *variant) {
+	LoadInst *load = builder.CreateLoad(
+		builder.CreateBitCast(variant, ret_type->getPointerTo())
+	);
+	load->setMetadata(LLVMContext::MD_tbaa, variant_tbaa);
+	return load;
+}
+
+void node_codegen::store_variant(Value *variant, Value *val) {
+	StoreInst *store = builder.CreateStore(
+		val, builder.CreateBitCast(variant, ret_type->getPointerTo())
+	);
+	store->setMetadata(LLVMContext::MD_tbaa, variant_tbaa);
+}
+
+void node_codegen::store_real(Value *variant, Value *val) {
+	Value *tindices[] = { builder.getInt32(0), builder.getInt32(0) };
+	Value *type = builder.CreateInBoundsGEP(variant, tindices);
+	builder.CreateStore(builder.getInt8(0), type)
+		->setMetadata(LLVMContext::MD_tbaa, tag_tbaa);
+
+	Value *rindices[] = { builder.getInt32(0), builder.getInt32(1) };
+	Value *real = builder.CreateBitCast(
+		builder.CreateInBoundsGEP(variant, rindices), real_type->getPointerTo()
+	);
+	builder.CreateStore(val, real)->setMetadata(LLVMContext::MD_tbaa, payload_tbaa);
+}
+
+// branches on a condition without boxing it, so && and || only evaluate their
+// right operand when it decides the result. conditions are true over 0.5, but
+// operands of the logical operators are true when nonzero, like the runtime's
+void node_codegen::branch(
+	expression *cond, BasicBlock *t, BasicBlock *f, bool nonzero
+) {
+	if (cond->type == unary_node && static_cast<unary*>(cond)->op == exclaim) {
+		branch(static_cast<unary*>(cond)->right, f, t, true);
+		return;
+	}
+
+	if (cond->type == binary_node) {
+		binary *b = static_cast<binary*>(cond);
+		Value *zero = ConstantFP::get(real_type, 0);
+		switch (b->op) {
+		default: break;
+
+		case ampamp: case pipepipe: {
+			Function *fn = builder.GetInsertBlock()->getParent();
+			BasicBlock *right = BasicBlock::Create(
+				fn->getContext(), b->op == ampamp ? "and" : "or"
+			);
+			if (b->op == ampamp) branch(b->left, right, f, true);
+			else branch(b->left, t, right, true);
+
+			fn->getBasicBlockList().push_back(right);
+			builder.SetInsertPoint(right);
+			branch(b->right, t, f, true);
+			return;
+		}
+
+		case caretcaret: {
+			Value *l = builder.CreateFCmpUNE(as_real(b->left), zero);
+			Value *r = builder.CreateFCmpUNE(as_real(b->right), zero);
+			builder.CreateCondBr(builder.CreateXor(l, r), t, f);
+			return;
+		}
+		}
+	}
+
+	Value *expr = as_real(cond);
+	Value *test = nonzero ?
+		builder.CreateFCmpUNE(expr, ConstantFP::get(real_type, 0)) :
+		builder.CreateFCmpUGT(expr, ConstantFP::get(real_type, 0.5));
+	builder.CreateCondBr(test, t, f);
+}
+
+// && and || as a real, merged from the branches that decide them
+Value *node_codegen::logical_value(binary *b) {
+	Function *f = builder.GetInsertBlock()->getParent();
+	BasicBlock *yes = BasicBlock::Create(f->getContext(), "true");
+	BasicBlock *no = BasicBlock::Create(f->getContext(), "false");
+	BasicBlock *merge = BasicBlock::Create(f->getContext(), "merge");
+
+	branch(b, yes, no);
+
+	f->getBasicBlockList().push_back(yes);
+	builder.SetInsertPoint(yes);
+	builder.CreateBr(merge);
+
+	f->getBasicBlockList().push_back(no);
+	builder.SetInsertPoint(no);
+	builder.CreateBr(merge);
+
+	f->getBasicBlockList().push_back(merge);
+	builder.SetInsertPoint(merge);
+	PHINode *phi = builder.CreatePHI(real_type, 2);
+	phi->addIncoming(ConstantFP::get(real_type, 1), yes);
+	phi->addIncoming(ConstantFP::get(real_type, 0), no);
+	return phi;
 }
 
 Value *node_codegen::is_equal(Value *a, Value *b) {
 	Value *res = alloc(variant_type);
-	builder.CreateCall3(get_operator("is_equals", 2), res, a, b);
-	Value *expr = builder.CreateCall(to_real, res);
+	CallInst *call = builder.CreateCall2(get_operator("is_equals", 2), a, b);
+	store_variant(res, call);
+
+	// is_equals always produces a real
+	Value *expr = load_real(res);
 	return builder.CreateFCmpUGT(expr, ConstantFP::get(builder.getDoubleTy(), 0.5));
 }
 
@@ -868,29 +1703,98 @@ Value *node_codegen::make_local(
 
 	Value *xindices[] = { builder.getInt32(0), builder.getInt32(0) };
 	Value *xptr = builder.CreateInBoundsGEP(l, xindices);
-	builder.CreateStore(x, xptr);
+	builder.CreateStore(x, xptr)->setMetadata(LLVMContext::MD_tbaa, var_tbaa);
 
 	Value *yindices[] = { builder.getInt32(0), builder.getInt32(1) };
 	Value *yptr = builder.CreateInBoundsGEP(l, yindices);
-	builder.CreateStore(y, yptr);
+	builder.CreateStore(y, yptr)->setMetadata(LLVMContext::MD_tbaa, var_tbaa);
 
 	Value *vindices[] = { builder.getInt32(0), builder.getInt32(2) };
 	Value *vptr = builder.CreateInBoundsGEP(l, vindices);
-	builder.CreateStore(values, vptr);
+	builder.CreateStore(values, vptr)->setMetadata(LLVMContext::MD_tbaa, var_tbaa);
 
 	builder.CreateCall(retain_var, l);
 
 	return l;
 }
 
+Value *node_codegen::get_slot(Value *scope, unsigned slot) {
+	Value *indices[] = { builder.getInt32(0), builder.getInt32(1) };
+	LoadInst *slots = builder.CreateLoad(builder.CreateInBoundsGEP(scope, indices));
+	slots->setMetadata(LLVMContext::MD_tbaa, scope_tbaa);
+	return builder.CreateInBoundsGEP(slots, builder.getInt64(slot));
+}
+
+// variables in self's layout are addressed directly, except inside a with,
+// where self is some other instance
+Value *node_codegen::get_self_slot(const identifier *name) {
+	if (self_scope != function_self) return 0;
+
+	auto slot = self_slots.find(name);
+	if (slot == self_slots.end()) return 0;
+
+	return get_slot(self_scope, slot->second);
+}
+
+// global.x for a name in the global layout
+Value *node_codegen::get_global_slot(expression *left, const identifier *name) {
+	if (left->type != value_node) return 0;
+	if (static_cast<value*>(left)->t.type != kw_global) return 0;
+
+	auto slot = global_slots.find(name);
+	if (slot == global_slots.end()) return 0;
+
+	if (!global_scope) {
+		global_scope = new GlobalVariable(
+			module, scope_type->getElementType(), false,
+			GlobalValue::ExternalLinkage, 0, "global_scope"
+		);
+	}
+	return get_slot(global_scope, slot->second);
+}
+
+// argument# that aren't scalars, in var arg functions or past a clone's
+// arity, are elements of the argument array
+Value *node_codegen::get_argument(const identifier *name) {
+	for (size_t i = 0; i < max_arguments; i++) {
+		if (argument_names[i] != name) continue;
+
+		return do_access(
+			scope[argument_name], builder.getInt16(i), builder.getInt16(0), lvalue
+		);
+	}
+	return 0;
+}
+
+// an rvalue access can still report an index error, so it isn't readonly
+Value *node_codegen::do_access(Value *var, Value *x, Value *y, bool lvalue) {
+	return builder.CreateCall4(access, var, x, y, builder.getInt1(lvalue));
+}
+
 Value *node_codegen::do_lookup(Value *left, Value *right, bool lvalue) {
+	Value *args[] = {
+		self_scope, other_scope, left, right, builder.getInt1(lvalue),
+		get_lookup_cache()
+	};
+	return builder.CreateCall(lookup, args);
+}
+
+// once the game's globalvars are known, other names can only be in self
+Value *node_codegen::do_lookup_default(const identifier *name, bool lvalue) {
+	Value *right = builder.CreateCall(to_string, get_string(name_ref(name)));
+	if (globals_registered && globalvars.find(name) == globalvars.end())
+		return do_lookup(ConstantFP::get(real_type, -1), right, lvalue);
+
 	return builder.CreateCall5(
-		lookup, self_scope, other_scope, left, right, builder.getInt1(lvalue)
+		lookup_default, self_scope, other_scope, right, builder.getInt1(lvalue),
+		get_lookup_cache()
 	);
 }
 
-Value *node_codegen::do_lookup_default(Value *right, bool lvalue) {
-	return builder.CreateCall4(
-		lookup_default, self_scope, other_scope, right, builder.getInt1(lvalue)
+// each lookup site remembers where it last found its variable
+Value *node_codegen::get_lookup_cache() {
+	return new GlobalVariable(
+		module, cache_type, false, GlobalValue::InternalLinkage,
+		ConstantAggregateZero::get(cache_type), "cache"
 	);
 }
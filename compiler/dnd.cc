@@ -0,0 +1,230 @@
+#include <dejavu/compiler/dnd.h>
+#include <dejavu/compiler/parser.h>
+#include <dejavu/compiler/identifier.h>
+#include <dejavu/linker/game.h>
+#include <dejavu/system/buffer.h>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+// actions that don't produce any code
+bool isempty(const action &act) {
+	switch (act.type->kind) {
+	case action_type::act_normal:
+		return act.type->exec == action_type::exec_none;
+
+	case action_type::act_begin: case action_type::act_end:
+	case action_type::act_else: case action_type::act_exit:
+	case action_type::act_repeat: case action_type::act_variable:
+	case action_type::act_code:
+		return false;
+
+	default:
+		return true;
+	}
+}
+
+// what the variable action's first argument has to parse as
+bool isassignable(const expression *e) {
+	switch (e->type) {
+	case value_node: return static_cast<const value*>(e)->t.type == v_name;
+	case binary_node: return static_cast<const binary*>(e)->op == dot;
+	case subscript_node: return true;
+	default: return false;
+	}
+}
+
+}
+
+action_parser::action_parser(
+	const event &evt, const std::string &name,
+	arena &allocator, identifier_pool &names, error_stream &e
+) :
+	evt(evt), name(name), current(0),
+	allocator(allocator), names(names), errors(e) {}
+
+node *action_parser::getprogram() {
+	list_builder<statement*> stmts(allocator);
+	while (peek()) {
+		stmts.push_back(getstatement());
+	}
+
+	return new (allocator) block(stmts);
+}
+
+statement *action_parser::getstatement() {
+	const action *act = peek();
+	if (!act) return error("expected an action");
+
+	unsigned int index = current++;
+	switch (act->type->kind) {
+	case action_type::act_begin: {
+		list_builder<statement*> stmts(allocator);
+		while (peek() && peek()->type->kind != action_type::act_end) {
+			stmts.push_back(getstatement());
+		}
+
+		if (!peek()) return error("expected an end of block action");
+		current++;
+
+		return new (allocator) block(stmts);
+	}
+
+	case action_type::act_end: return error("unexpected end of block action");
+	case action_type::act_else: return error("unexpected else action");
+
+	case action_type::act_exit: return new (allocator) jump(kw_exit);
+
+	case action_type::act_repeat: {
+		expression *count = getexpression(act->args[0].val);
+		return new (allocator) repeatstatement(count, getbody("repeat"));
+	}
+
+	case action_type::act_variable: {
+		expression *lvalue = getexpression(act->args[0].val);
+		if (lvalue->type == expression_error_node)
+			return new (allocator) statement_error;
+		if (!isassignable(lvalue)) return error("expected a variable");
+
+		expression *rvalue = getexpression(act->args[1].val);
+		return new (allocator) assignment(
+			act->relative ? plus_equals : equals, lvalue, rvalue
+		);
+	}
+
+	case action_type::act_code: {
+		std::ostringstream s;
+		s << name << "_" << index;
+
+		list_builder<expression*> args(allocator);
+		return new (allocator) invocation(
+			new (allocator) call(getname(s.str()), args)
+		);
+	}
+
+	default: {
+		expression *c = getcall(*act);
+
+		statement *stmt;
+		if (act->type->question) {
+			expression *cond = act->inv ?
+				new (allocator) unary(exclaim, c) : c;
+			statement *branch_true = getbody("question");
+
+			statement *branch_false = 0;
+			if (peek() && peek()->type->kind == action_type::act_else) {
+				current++;
+				branch_false = getbody("else");
+			}
+
+			stmt = new (allocator) ifstatement(cond, branch_true, branch_false);
+		}
+		else {
+			stmt = new (allocator) invocation(static_cast<call*>(c));
+		}
+
+		if (act->target != action::self) {
+			stmt = new (allocator) withstatement(getreal(act->target), stmt);
+		}
+
+		return stmt;
+	}
+	}
+}
+
+// returns the statement controlled by a question, repeat or else action
+statement *action_parser::getbody(const char *after) {
+	if (!peek()) return error(std::string("expected an action after ") + after);
+	return getstatement();
+}
+
+expression *action_parser::getcall(const action &act) {
+	list_builder<expression*> args(allocator);
+	for (unsigned int n = 0; n < act.nargs; n++) {
+		args.push_back(getargument(act.args[n]));
+	}
+	if (act.type->relative) {
+		args.push_back(getreal(act.relative));
+	}
+
+	value *function;
+	if (act.type->exec == action_type::exec_code) {
+		std::ostringstream s;
+		s << "action_lib";
+		if (act.type->parent > -1) s << act.type->parent;
+		s << "_" << act.type->id;
+		function = getname(s.str());
+	}
+	else {
+		function = getname(act.type->code);
+	}
+
+	return new (allocator) call(function, args);
+}
+
+expression *action_parser::getargument(const argument &arg) {
+	switch (arg.kind) {
+	case argument::arg_expr: case argument::arg_menu:
+		return getexpression(arg.val);
+
+	case argument::arg_both:
+		if (arg.val[0] == '"' || arg.val[0] == '\'')
+			return getexpression(arg.val);
+
+	// fall through
+	case argument::arg_string:
+		return getstring(arg.val, strlen(arg.val));
+
+	case argument::arg_bool:
+		return getreal(arg.val[0] == '0');
+
+	case argument::arg_color:
+		return getreal(strtoul(arg.val, 0, 16));
+
+	default:
+		return getreal(arg.resource);
+	}
+}
+
+// parses GML code from an argument; the AST points into the action itself
+expression *action_parser::getexpression(const char *code) {
+	buffer b(strlen(code), code);
+	token_stream tokens(b, names);
+	parser p(tokens, allocator, errors);
+	return p.getargument();
+}
+
+value *action_parser::getname(const std::string &n) {
+	token t(v_name, 0, n.size());
+	t.name = names.intern(n.data(), n.size());
+	return new (allocator) value(t);
+}
+
+value *action_parser::getreal(double real) {
+	token t(v_real, 0);
+	t.real = real;
+	return new (allocator) value(t);
+}
+
+value *action_parser::getstring(const char *data, size_t length) {
+	token t(v_string, 0);
+	t.data = data;
+	t.length = length;
+	return new (allocator) value(t);
+}
+
+// returns the next action that produces code, or null at the end of the event
+const action *action_parser::peek() {
+	while (current < evt.nactions && isempty(evt.actions[current])) {
+		current++;
+	}
+
+	return current < evt.nactions ? &evt.actions[current] : 0;
+}
+
+statement_error *action_parser::error(const std::string &message) {
+	errors.error(name + ": error: " + message + "\n");
+	return new (allocator) statement_error;
+}
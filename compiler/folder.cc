@@ -0,0 +1,361 @@
+#include <dejavu/compiler/folder.h>
+#include <dejavu/compiler/identifier.h>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// the runtime converts to int with a plain cast, which is only defined in range
+bool to_int(double real, int &result) {
+	if (!(real > INT_MIN - 1.0 && real < INT_MAX + 1.0)) return false;
+
+	result = (int)real;
+	return true;
+}
+
+// a statement can only be removed if it declares no locals and has no case
+// labels, because both take effect whether or not the statement runs
+struct drop_checker : public node_visitor<drop_checker, bool> {
+	bool check(statement *s) { return !s || visit(s); }
+
+	bool visit_assignment(assignment*) { return true; }
+	bool visit_invocation(invocation*) { return true; }
+	bool visit_declaration(declaration*) { return false; }
+	bool visit_block(block *b) {
+		for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it) {
+			if (!check(*it)) return false;
+		}
+		return true;
+	}
+
+	bool visit_ifstatement(ifstatement *i) {
+		return check(i->branch_true) && check(i->branch_false);
+	}
+	bool visit_whilestatement(whilestatement *w) { return check(w->stmt); }
+	bool visit_dostatement(dostatement *d) { return check(d->stmt); }
+	bool visit_repeatstatement(repeatstatement *r) { return check(r->stmt); }
+	bool visit_forstatement(forstatement *f) {
+		return check(f->init) && check(f->inc) && check(f->stmt);
+	}
+	bool visit_switchstatement(switchstatement *s) { return check(s->stmts); }
+	bool visit_withstatement(withstatement *w) { return check(w->stmt); }
+
+	bool visit_jump(jump*) { return true; }
+	bool visit_returnstatement(returnstatement*) { return true; }
+	bool visit_casestatement(casestatement*) { return false; }
+
+	bool visit_statement_error(statement_error*) { return true; }
+};
+
+}
+
+node_folder::node_folder(arena &allocator, identifier_pool &names) :
+	allocator(allocator), string_name(names.intern("string", 6)) {}
+
+node *node_folder::visit_unary(unary *u) {
+	u->right = fold(u->right);
+
+	token a;
+	if (!constant(u->right, a) || a.type != v_real) return u;
+
+	int i;
+	switch (u->op) {
+	case exclaim: return make_real(!a.real);
+	case tilde:
+		if (!to_int(a.real, i)) return u;
+		return make_real(~i);
+	case minus: return make_real(-a.real);
+	case plus: return make_real(+a.real);
+
+	default: return u;
+	}
+}
+
+node *node_folder::visit_binary(binary *b) {
+	b->left = fold(b->left);
+	if (b->op == dot) return b;
+	b->right = fold(b->right);
+
+	token l, r;
+	if (!constant(b->left, l) || !constant(b->right, r)) return b;
+
+	// comparing a real with a string is false rather than an error
+	if (l.type != r.type) {
+		switch (b->op) {
+		case is_equals: return make_real(0);
+		case not_equals: return make_real(1);
+		default: return b;
+		}
+	}
+
+	// strings are interned, so the runtime's pointer comparison compares text
+	if (l.type == v_string) {
+		bool equal = l.length == r.length && memcmp(l.data, r.data, l.length) == 0;
+
+		switch (b->op) {
+		case is_equals: return make_real(equal);
+		case not_equals: return make_real(!equal);
+
+		case plus: {
+			size_t length = l.length + r.length;
+			if (length > max_token_length) return b;
+
+			char *data = static_cast<char*>(allocator.allocate(length, 1));
+			memcpy(data, l.data, l.length);
+			memcpy(data + l.length, r.data, r.length);
+			return make_string(data, length);
+		}
+
+		default: return b;
+		}
+	}
+
+	double x = l.real, y = r.real;
+	int i, j;
+	switch (b->op) {
+	case less: return make_real(x < y);
+	case less_equals: return make_real(x <= y);
+	case is_equals: return make_real(x == y);
+	case not_equals: return make_real(x != y);
+	case greater_equals: return make_real(x >= y);
+	case greater: return make_real(x > y);
+
+	case plus: return make_real(x + y);
+	case minus: return make_real(x - y);
+	case times: return make_real(x * y);
+	case divide: return make_real(x / y);
+
+	case ampamp: return make_real(x && y);
+	case pipepipe: return make_real(x || y);
+	case caretcaret: return make_real((bool)x != (bool)y);
+
+	case bit_and: case bit_or: case bit_xor:
+	case shift_left: case shift_right:
+		if (!to_int(x, i) || !to_int(y, j)) return b;
+
+		switch (b->op) {
+		case bit_and: return make_real(i & j);
+		case bit_or: return make_real(i | j);
+		case bit_xor: return make_real(i ^ j);
+
+		// leave shifts that would overflow to the runtime
+		case shift_left:
+			if (j < 0 || j > 31 || i < 0 || i > (INT_MAX >> j)) return b;
+			return make_real(i << j);
+		case shift_right:
+			if (j < 0 || j > 31) return b;
+			return make_real(i >> j);
+
+		default: return b;
+		}
+
+	case kw_div:
+		if (!to_int(x / y, i)) return b;
+		return make_real(i);
+	case kw_mod: return make_real(fmod(x, y));
+
+	default: return b;
+	}
+}
+
+node *node_folder::visit_subscript(subscript *s) {
+	s->array = fold(s->array);
+	for (expression **it = s->indices.begin(); it != s->indices.end(); ++it) {
+		*it = fold(*it);
+	}
+
+	return s;
+}
+
+node *node_folder::visit_call(call *c) {
+	for (expression **it = c->args.begin(); it != c->args.end(); ++it) {
+		*it = fold(*it);
+	}
+
+	// string() formats reals with %g, the same way as the runtime
+	token a;
+	if (
+		c->function->t.name != string_name || c->args.size() != 1 ||
+		!constant(c->args[0], a)
+	)
+		return c;
+
+	if (a.type == v_string) return make_string(a.data, a.length);
+
+	int length = snprintf(nullptr, 0, "%g", a.real);
+	char *data = static_cast<char*>(allocator.allocate(length + 1, 1));
+	snprintf(data, length + 1, "%g", a.real);
+	return make_string(data, length);
+}
+
+node *node_folder::visit_assignment(assignment *a) {
+	a->lvalue = fold(a->lvalue);
+	a->rvalue = fold(a->rvalue);
+	return a;
+}
+
+// the call is kept, even if its result could be folded
+node *node_folder::visit_invocation(invocation *i) {
+	for (expression **it = i->c->args.begin(); it != i->c->args.end(); ++it) {
+		*it = fold(*it);
+	}
+
+	return i;
+}
+
+node *node_folder::visit_block(block *b) {
+	for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it) {
+		*it = fold(*it);
+	}
+
+	return b;
+}
+
+node *node_folder::visit_ifstatement(ifstatement *i) {
+	i->branch_true = fold(i->branch_true);
+	i->branch_false = fold(i->branch_false);
+
+	bool result;
+	if (!condition(i->cond, result)) return i;
+
+	statement *taken = result ? i->branch_true : i->branch_false;
+	statement *dropped = result ? i->branch_false : i->branch_true;
+	if (!droppable(dropped)) return i;
+
+	return taken ? taken : make_empty();
+}
+
+node *node_folder::visit_whilestatement(whilestatement *w) {
+	w->stmt = fold(w->stmt);
+
+	bool result;
+	if (condition(w->cond, result) && !result && droppable(w->stmt)) {
+		return make_empty();
+	}
+
+	return w;
+}
+
+node *node_folder::visit_dostatement(dostatement *d) {
+	d->stmt = fold(d->stmt);
+
+	bool result;
+	condition(d->cond, result);
+	return d;
+}
+
+node *node_folder::visit_repeatstatement(repeatstatement *r) {
+	r->expr = fold(r->expr);
+	r->stmt = fold(r->stmt);
+
+	token count;
+	if (
+		constant(r->expr, count) && count.type == v_real &&
+		count.real <= 0 && droppable(r->stmt)
+	)
+		return make_empty();
+
+	return r;
+}
+
+node *node_folder::visit_forstatement(forstatement *f) {
+	f->init = fold(f->init);
+	f->inc = fold(f->inc);
+	f->stmt = fold(f->stmt);
+
+	bool result;
+	if (
+		condition(f->cond, result) && !result &&
+		droppable(f->inc) && droppable(f->stmt)
+	)
+		return f->init;
+
+	return f;
+}
+
+node *node_folder::visit_switchstatement(switchstatement *s) {
+	s->expr = fold(s->expr);
+	visit_block(s->stmts);
+	return s;
+}
+
+node *node_folder::visit_withstatement(withstatement *w) {
+	w->expr = fold(w->expr);
+	w->stmt = fold(w->stmt);
+	return w;
+}
+
+node *node_folder::visit_returnstatement(returnstatement *r) {
+	r->expr = fold(r->expr);
+	return r;
+}
+
+node *node_folder::visit_casestatement(casestatement *c) {
+	c->expr = fold(c->expr);
+	return c;
+}
+
+// gets the value of a constant expression as a real or string token
+// keywords have the same values they get in codegen
+bool node_folder::constant(expression *e, token &t) {
+	if (e->type != value_node) return false;
+
+	t = static_cast<value*>(e)->t;
+	switch (t.type) {
+	case v_real: case v_string: return true;
+
+	case kw_true: t.real = 1; break;
+	case kw_false: t.real = 0; break;
+
+	case kw_self: t.real = -1; break;
+	case kw_other: t.real = -2; break;
+	case kw_all: t.real = -3; break;
+	case kw_noone: t.real = -4; break;
+	case kw_global: t.real = -5; break;
+	case kw_local: t.real = -6; break;
+
+	default: return false;
+	}
+
+	t.type = v_real;
+	return true;
+}
+
+// folds a condition, and if it's constant works out whether it holds
+// constant conditions become plain reals so codegen can branch on them directly
+bool node_folder::condition(expression *&cond, bool &result) {
+	cond = fold(cond);
+
+	token t;
+	if (!constant(cond, t) || t.type != v_real) return false;
+
+	if (static_cast<value*>(cond)->t.type != v_real) {
+		cond = make_real(t.real);
+	}
+
+	// codegen tests conditions with an unordered compare, so nan is true
+	result = !(t.real <= 0.5);
+	return true;
+}
+
+value *node_folder::make_real(double real) {
+	token t(v_real, 0);
+	t.real = real;
+	return new (allocator) value(t);
+}
+
+value *node_folder::make_string(const char *data, size_t length) {
+	token t(v_string, 0, length);
+	t.data = data;
+	return new (allocator) value(t);
+}
+
+block *node_folder::make_empty() {
+	return new (allocator) block(node_list<statement*>());
+}
+
+bool node_folder::droppable(statement *s) {
+	return drop_checker().check(s);
+}
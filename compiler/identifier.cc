@@ -0,0 +1,47 @@
+#include <dejavu/compiler/identifier.h>
+#include <dejavu/system/string.h>
+#include <cstring>
+
+bool identifier_pool::key_equal::operator()(const key &a, const key &b) const {
+	return
+		a.hash == b.hash && a.length == b.length &&
+		memcmp(a.data, b.data, a.length) == 0;
+}
+
+const identifier *identifier_pool::intern(const char *data, size_t length) {
+	key k = { data, length, string::compute_hash(length, data) };
+
+	identifier_table::node *n = pool.find(k);
+	if (n != pool.end()) {
+		return n->v;
+	}
+
+	// copy the name so it outlives the source it came from
+	char *copy = static_cast<char*>(allocator.allocate(length, 1));
+	memcpy(copy, data, length);
+
+	identifier *id = new (allocator) identifier;
+	id->length = length;
+	id->data = copy;
+
+	k.data = copy;
+	pool.insert(k) = id;
+	return id;
+}
+
+const identifier *identifier_pool::find(const char *data, size_t length) {
+	key k = { data, length, string::compute_hash(length, data) };
+
+	identifier_table::node *n = pool.find(k);
+	return n != pool.end() ? n->v : 0;
+}
+
+bool is_numbered_argument(const identifier *name) {
+	if (name->length <= 8 || memcmp(name->data, "argument", 8) != 0)
+		return false;
+
+	for (size_t i = 8; i < name->length; i++) {
+		if (name->data[i] < '0' || name->data[i] > '9') return false;
+	}
+	return true;
+}
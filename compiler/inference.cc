@@ -0,0 +1,468 @@
+#include <dejavu/compiler/inference.h>
+#include <dejavu/compiler/node_visitor.h>
+#include <dejavu/compiler/identifier.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// resolves names the same way codegen does: a name refers to a local once a
+// var declaration for it has been visited, in the order codegen visits nodes
+struct local_resolver : public node_visitor<local_resolver> {
+	local_resolver(
+		std::unordered_set<const value*> &locals,
+		const identifier *argument_name, const identifier *argument_count_name
+	) :
+		locals(locals),
+		argument_name(argument_name), argument_count_name(argument_count_name) {}
+
+	void resolve(node *n) { if (n) visit(n); }
+
+	void visit_value(value *v) {
+		if (v->t.type == v_name && declared.find(v->t.name) != declared.end())
+			locals.insert(v);
+	}
+	void visit_unary(unary *u) { resolve(u->right); }
+	void visit_binary(binary *b) {
+		resolve(b->left);
+		if (b->op != dot) resolve(b->right);
+	}
+	void visit_subscript(subscript *s) {
+		resolve(s->array);
+		for (expression **it = s->indices.begin(); it != s->indices.end(); ++it)
+			resolve(*it);
+
+		if (s->array->type == value_node) {
+			value *v = static_cast<value*>(s->array);
+			if (locals.find(v) != locals.end()) subscripted.insert(v->t.name);
+		}
+	}
+	void visit_call(call *c) {
+		for (expression **it = c->args.begin(); it != c->args.end(); ++it)
+			resolve(*it);
+	}
+
+	void visit_assignment(assignment *a) {
+		resolve(a->rvalue);
+		resolve(a->lvalue);
+
+		if (a->lvalue->type == value_node) {
+			value *v = static_cast<value*>(a->lvalue);
+			if (locals.find(v) != locals.end()) assignments.push_back(a);
+		}
+	}
+	void visit_invocation(invocation *i) { resolve(i->c); }
+	void visit_declaration(declaration *d) {
+		if (d->type.type != kw_var) return;
+
+		for (value **it = d->names.begin(); it != d->names.end(); ++it) {
+			const identifier *name = (*it)->t.name;
+			if (name == argument_name || name == argument_count_name) continue;
+			declared.insert(name);
+		}
+	}
+	void visit_block(block *b) {
+		for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it)
+			resolve(*it);
+	}
+
+	void visit_ifstatement(ifstatement *i) {
+		resolve(i->cond);
+		resolve(i->branch_true);
+		resolve(i->branch_false);
+	}
+	void visit_whilestatement(whilestatement *w) {
+		resolve(w->cond);
+		resolve(w->stmt);
+	}
+	void visit_dostatement(dostatement *d) {
+		resolve(d->stmt);
+		resolve(d->cond);
+	}
+	void visit_repeatstatement(repeatstatement *r) {
+		resolve(r->expr);
+		resolve(r->stmt);
+	}
+	void visit_forstatement(forstatement *f) {
+		resolve(f->init);
+		resolve(f->cond);
+		resolve(f->stmt);
+		resolve(f->inc);
+	}
+	void visit_switchstatement(switchstatement *s) {
+		resolve(s->expr);
+		resolve(s->stmts);
+	}
+	void visit_withstatement(withstatement *w) {
+		resolve(w->expr);
+		resolve(w->stmt);
+	}
+
+	void visit_returnstatement(returnstatement *r) { resolve(r->expr); }
+	void visit_casestatement(casestatement *c) { resolve(c->expr); }
+
+	std::unordered_set<const value*> &locals;
+	std::unordered_set<const identifier*> declared;
+	std::unordered_set<const identifier*> subscripted;
+	std::vector<assignment*> assignments;
+
+	const identifier *argument_name;
+	const identifier *argument_count_name;
+};
+
+// which locals are definitely assigned at a point in the program
+struct flow_state {
+	std::vector<bool> assigned;
+	bool reachable;
+
+	bool operator ==(const flow_state &o) const {
+		return reachable == o.reachable && assigned == o.assigned;
+	}
+};
+
+// a local is only definitely assigned where paths meet if it is on all of them
+void meet(flow_state &a, const flow_state &b) {
+	if (!b.reachable) return;
+	if (!a.reachable) { a = b; return; }
+
+	for (size_t i = 0; i < a.assigned.size(); i++)
+		a.assigned[i] = a.assigned[i] && b.assigned[i];
+}
+
+// finds locals that may be read before they're assigned
+// loops are walked until their entry state stops changing- states only shrink,
+// so the last walk is the strictest and reports everything earlier ones did
+struct definite_assignment : public node_visitor<definite_assignment> {
+	definite_assignment(
+		const std::unordered_set<const value*> &locals,
+		const std::unordered_map<const identifier*, size_t> &index,
+		std::unordered_set<const identifier*> &unassigned
+	) :
+		locals(locals), index(index), unassigned(unassigned),
+		breaks(0), continues(0), switch_entry(0), default_label(0) {
+
+		current.assigned.assign(index.size(), false);
+		current.reachable = true;
+	}
+
+	void check(node *n) { if (n) visit(n); }
+
+	void visit_value(value *v) {
+		if (!current.reachable || locals.find(v) == locals.end()) return;
+
+		auto i = index.find(v->t.name);
+		if (i != index.end() && !current.assigned[i->second])
+			unassigned.insert(v->t.name);
+	}
+	void visit_unary(unary *u) { check(u->right); }
+	void visit_binary(binary *b) {
+		check(b->left);
+		if (b->op != dot) check(b->right);
+	}
+	void visit_subscript(subscript *s) {
+		check(s->array);
+		for (expression **it = s->indices.begin(); it != s->indices.end(); ++it)
+			check(*it);
+	}
+	void visit_call(call *c) {
+		for (expression **it = c->args.begin(); it != c->args.end(); ++it)
+			check(*it);
+	}
+
+	void visit_assignment(assignment *a) {
+		if (a->op != equals) check(a->lvalue);
+		check(a->rvalue);
+
+		if (a->lvalue->type != value_node) {
+			if (a->op == equals) check(a->lvalue);
+			return;
+		}
+
+		value *v = static_cast<value*>(a->lvalue);
+		auto i = index.find(v->t.name);
+		if (locals.find(v) != locals.end() && i != index.end())
+			current.assigned[i->second] = true;
+	}
+	void visit_invocation(invocation *i) { check(i->c); }
+	void visit_declaration(declaration *d) {
+		if (d->type.type != kw_var) return;
+
+		for (value **it = d->names.begin(); it != d->names.end(); ++it) {
+			auto i = index.find((*it)->t.name);
+			if (i != index.end()) current.assigned[i->second] = false;
+		}
+	}
+	void visit_block(block *b) {
+		for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it)
+			check(*it);
+	}
+
+	void visit_ifstatement(ifstatement *i) {
+		check(i->cond);
+
+		flow_state entry = current;
+		check(i->branch_true);
+		std::swap(entry, current);
+		check(i->branch_false);
+		meet(current, entry);
+	}
+
+	// cond is checked at the top of each iteration, before stmt and then inc
+	void loop(expression *cond, statement *stmt, statement *inc) {
+		flow_state entry = current, head = current, exit;
+		std::vector<flow_state> loop_breaks, loop_continues;
+
+		while (true) {
+			current = head;
+			check(cond);
+			exit = current;
+
+			loop_breaks.clear();
+			loop_continues.clear();
+			{
+				save_jumps save(*this);
+				breaks = &loop_breaks;
+				continues = &loop_continues;
+				check(stmt);
+			}
+			for (const flow_state &s : loop_continues) meet(current, s);
+			check(inc);
+
+			flow_state next = entry;
+			meet(next, current);
+			if (next == head) break;
+			head = next;
+		}
+
+		current = exit;
+		for (const flow_state &s : loop_breaks) meet(current, s);
+	}
+
+	void visit_whilestatement(whilestatement *w) { loop(w->cond, w->stmt, 0); }
+	void visit_dostatement(dostatement *d) {
+		flow_state entry = current, head = current, exit;
+		std::vector<flow_state> loop_breaks, loop_continues;
+
+		while (true) {
+			current = head;
+
+			loop_breaks.clear();
+			loop_continues.clear();
+			{
+				save_jumps save(*this);
+				breaks = &loop_breaks;
+				continues = &loop_continues;
+				check(d->stmt);
+			}
+			for (const flow_state &s : loop_continues) meet(current, s);
+			check(d->cond);
+			exit = current;
+
+			flow_state next = entry;
+			meet(next, current);
+			if (next == head) break;
+			head = next;
+		}
+
+		current = exit;
+		for (const flow_state &s : loop_breaks) meet(current, s);
+	}
+	void visit_repeatstatement(repeatstatement *r) {
+		check(r->expr);
+		loop(0, r->stmt, 0);
+	}
+	void visit_forstatement(forstatement *f) {
+		check(f->init);
+		loop(f->cond, f->stmt, f->inc);
+	}
+	void visit_withstatement(withstatement *w) {
+		check(w->expr);
+		loop(0, w->stmt, 0);
+	}
+
+	// statements before the first case label are never reached, and each
+	// label can be reached from the switch as well as by falling through
+	void visit_switchstatement(switchstatement *s) {
+		check(s->expr);
+
+		flow_state entry = current;
+		std::vector<flow_state> switch_breaks;
+		bool has_default = false;
+		{
+			save_jumps save(*this);
+			breaks = &switch_breaks;
+			switch_entry = &entry;
+			default_label = &has_default;
+
+			current.reachable = false;
+			check(s->stmts);
+		}
+
+		if (!has_default) meet(current, entry);
+		for (const flow_state &b : switch_breaks) meet(current, b);
+	}
+
+	void visit_jump(jump *j) {
+		switch (j->type) {
+		case kw_break: if (breaks) breaks->push_back(current); break;
+		case kw_continue: if (continues) continues->push_back(current); break;
+		default: break;
+		}
+
+		current.reachable = false;
+	}
+	void visit_returnstatement(returnstatement *r) {
+		check(r->expr);
+		current.reachable = false;
+	}
+	void visit_casestatement(casestatement *c) {
+		if (!switch_entry) return;
+
+		if (c->expr) {
+			std::swap(current, *switch_entry);
+			check(c->expr);
+			std::swap(current, *switch_entry);
+		}
+		else {
+			*default_label = true;
+		}
+
+		meet(current, *switch_entry);
+	}
+
+	// break, continue and case labels target the innermost enclosing construct
+	struct save_jumps {
+		save_jumps(definite_assignment &d) :
+			d(d), breaks(d.breaks), continues(d.continues),
+			switch_entry(d.switch_entry), default_label(d.default_label) {}
+		~save_jumps() {
+			d.breaks = breaks;
+			d.continues = continues;
+			d.switch_entry = switch_entry;
+			d.default_label = default_label;
+		}
+
+		definite_assignment &d;
+		std::vector<flow_state> *breaks, *continues;
+		flow_state *switch_entry;
+		bool *default_label;
+	};
+
+	const std::unordered_set<const value*> &locals;
+	const std::unordered_map<const identifier*, size_t> &index;
+	std::unordered_set<const identifier*> &unassigned;
+
+	flow_state current;
+	std::vector<flow_state> *breaks, *continues;
+	flow_state *switch_entry;
+	bool *default_label;
+};
+
+}
+
+type_inference::type_inference(identifier_pool &names) :
+	string_name(names.intern("string", 6)),
+	argument_name(names.intern("argument", 8)),
+	argument_count_name(names.intern("argument_count", 14)) {}
+
+void type_inference::infer(node *body) {
+	locals.clear();
+	scalars.clear();
+	reals.clear();
+
+	local_resolver resolver(locals, argument_name, argument_count_name);
+	resolver.resolve(body);
+
+	std::unordered_map<const identifier*, size_t> index;
+	for (const identifier *name : resolver.declared) {
+		if (resolver.subscripted.find(name) != resolver.subscripted.end())
+			continue;
+
+		size_t i = index.size();
+		index[name] = i;
+	}
+
+	std::unordered_set<const identifier*> unassigned;
+	definite_assignment checker(locals, index, unassigned);
+	checker.check(body);
+
+	for (auto &i : index) {
+		if (unassigned.find(i.first) == unassigned.end()) scalars.insert(i.first);
+	}
+	reals = scalars;
+
+	// start from every candidate and drop any assigned something else, until
+	// nothing changes- dropping one local can make others' values non-real
+	bool changed = true;
+	while (changed) {
+		changed = false;
+
+		for (assignment *a : resolver.assignments) {
+			const identifier *name = static_cast<value*>(a->lvalue)->t.name;
+			if (!is_real(name)) continue;
+
+			value_type type;
+			if (a->op == equals) {
+				type = type_of(a->rvalue);
+			}
+			else if (a->op == plus_equals) {
+				binary b(plus, a->lvalue, a->rvalue);
+				type = type_of(&b);
+			}
+			else {
+				type = type_real;
+			}
+
+			if (type != type_real) {
+				reals.erase(name);
+				changed = true;
+			}
+		}
+	}
+}
+
+// operators either produce a real or stop the game with an error, except for
+// + which also concatenates strings
+value_type type_inference::type_of(expression *e) const {
+	switch (e->type) {
+	default: return type_any;
+
+	case value_node: {
+		value *v = static_cast<value*>(e);
+		switch (v->t.type) {
+		default: return type_any;
+
+		case v_name:
+			return locals.find(v) != locals.end() && is_real(v->t.name) ?
+				type_real : type_any;
+
+		case v_real:
+		case kw_self: case kw_other: case kw_all: case kw_noone:
+		case kw_global: case kw_local: case kw_true: case kw_false:
+			return type_real;
+
+		case v_string: return type_string;
+		}
+	}
+
+	case unary_node: return type_real;
+
+	case binary_node: {
+		binary *b = static_cast<binary*>(e);
+		if (b->op == dot) return type_any;
+		if (b->op != plus) return type_real;
+
+		value_type left = type_of(b->left), right = type_of(b->right);
+		if (left == type_real || right == type_real) return type_real;
+		if (left == type_string || right == type_string) return type_string;
+		return type_any;
+	}
+
+	case call_node: {
+		call *c = static_cast<call*>(e);
+		if (c->function->t.name == string_name && c->args.size() == 1)
+			return type_string;
+		return type_any;
+	}
+	}
+}
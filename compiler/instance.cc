@@ -0,0 +1,143 @@
+#include <dejavu/compiler/instance.h>
+#include <dejavu/compiler/identifier.h>
+#include <cstring>
+
+namespace {
+	bool is_named(const identifier *name, const char *text) {
+		size_t length = strlen(text);
+		return name->length == length && memcmp(name->data, text, length) == 0;
+	}
+
+	// functions bind argument and argument_count, and read argument# out of
+	// the argument array, so none of them is an instance variable
+	bool is_argument(const identifier *name) {
+		return
+			is_named(name, "argument") || is_named(name, "argument_count") ||
+			is_numbered_argument(name);
+	}
+}
+
+void instance_variables::collect(node *program) {
+	locals.clear();
+	with_depth = 0;
+	check(program);
+}
+
+// names resolve to locals once their declaration has been seen, like codegen
+void instance_variables::visit_value(value *v) {
+	if (v->t.type != v_name || with_depth > 0) return;
+	if (locals.find(v->t.name) != locals.end()) return;
+	if (is_argument(v->t.name)) return;
+
+	if (seen.insert(v->t.name).second) names.push_back(v->t.name);
+}
+
+void instance_variables::visit_unary(unary *u) {
+	check(u->right);
+}
+
+// the right side of a dot belongs to another instance
+void instance_variables::visit_binary(binary *b) {
+	check(b->left);
+	if (b->op != dot) {
+		check(b->right);
+		return;
+	}
+
+	value *left = static_cast<value*>(b->left);
+	if (b->left->type == value_node && left->t.type == kw_global)
+		add_global(static_cast<value*>(b->right)->t.name);
+}
+
+void instance_variables::visit_subscript(subscript *s) {
+	check(s->array);
+	for (expression **it = s->indices.begin(); it != s->indices.end(); ++it) {
+		check(*it);
+	}
+}
+
+void instance_variables::visit_call(call *c) {
+	calls[c->function->t.name].insert(c->args.size());
+	for (expression **it = c->args.begin(); it != c->args.end(); ++it) {
+		check(*it);
+	}
+}
+
+void instance_variables::visit_assignment(assignment *a) {
+	check(a->rvalue);
+	check(a->lvalue);
+}
+
+void instance_variables::visit_invocation(invocation *i) {
+	check(i->c);
+}
+
+void instance_variables::visit_declaration(declaration *d) {
+	for (value **it = d->names.begin(); it != d->names.end(); ++it) {
+		if (d->type.type == kw_globalvar) {
+			globalvars.insert((*it)->t.name);
+			add_global((*it)->t.name);
+		}
+		else locals.insert((*it)->t.name);
+	}
+}
+
+void instance_variables::add_global(const identifier *name) {
+	if (seen_globals.insert(name).second) globals.push_back(name);
+}
+
+void instance_variables::visit_block(block *b) {
+	for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it) {
+		check(*it);
+	}
+}
+
+void instance_variables::visit_ifstatement(ifstatement *i) {
+	check(i->cond);
+	check(i->branch_true);
+	check(i->branch_false);
+}
+
+void instance_variables::visit_whilestatement(whilestatement *w) {
+	check(w->cond);
+	check(w->stmt);
+}
+
+void instance_variables::visit_dostatement(dostatement *d) {
+	check(d->stmt);
+	check(d->cond);
+}
+
+void instance_variables::visit_repeatstatement(repeatstatement *r) {
+	check(r->expr);
+	check(r->stmt);
+}
+
+void instance_variables::visit_forstatement(forstatement *f) {
+	check(f->init);
+	check(f->cond);
+	check(f->stmt);
+	check(f->inc);
+}
+
+void instance_variables::visit_switchstatement(switchstatement *s) {
+	check(s->expr);
+	check(s->stmts);
+}
+
+// the body runs with each matching instance as self
+void instance_variables::visit_withstatement(withstatement *w) {
+	check(w->expr);
+
+	with_depth++;
+	check(w->stmt);
+	with_depth--;
+}
+
+void instance_variables::visit_returnstatement(returnstatement *r) {
+	check(r->expr);
+}
+
+void instance_variables::visit_casestatement(casestatement *c) {
+	check(c->expr);
+}
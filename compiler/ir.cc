@@ -0,0 +1,316 @@
+#include <dejavu/compiler/ir.h>
+#include <dejavu/compiler/identifier.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+bool ir_inst::is_pure() const {
+	switch (opcode) {
+	default: return false;
+
+	case op_real: case op_string:
+	case op_slot: case op_load:
+	case op_box:
+	case op_real_unary: case op_real_binary:
+	case op_phi:
+		return true;
+	}
+}
+
+ir_block *ir_function::add_block(const char *label) {
+	blocks.emplace_back(new ir_block(label));
+	return blocks.back().get();
+}
+
+void ir_function::replace_uses(ir_inst *of, ir_inst *with) {
+	for (auto &b : blocks) {
+		for (auto &inst : b->insts) {
+			std::replace(inst->operands.begin(), inst->operands.end(), of, with);
+		}
+	}
+}
+
+size_t ir_function::count(ir_opcode opcode) const {
+	size_t n = 0;
+	for (auto &b : blocks) {
+		for (auto &inst : b->insts) {
+			if (inst->opcode == opcode) n++;
+		}
+	}
+	return n;
+}
+
+std::vector<ir_block*> ir_function::reverse_postorder() const {
+	std::vector<ir_block*> order;
+	std::unordered_set<ir_block*> visited;
+
+	// each entry is a block and how many of its successors have been pushed
+	std::vector<std::pair<ir_block*, size_t>> stack;
+	stack.emplace_back(entry(), 0);
+	visited.insert(entry());
+	while (!stack.empty()) {
+		ir_block *b = stack.back().first;
+		size_t &next = stack.back().second;
+
+		ir_inst *term = b->terminator();
+		if (term && next < term->targets.size()) {
+			ir_block *succ = term->targets[next++];
+			if (visited.insert(succ).second) stack.emplace_back(succ, 0);
+			continue;
+		}
+
+		order.push_back(b);
+		stack.pop_back();
+	}
+
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+namespace {
+	const char *opcode_name(ir_opcode opcode) {
+		switch (opcode) {
+		default: return "?";
+
+		case op_real: return "real";
+		case op_string: return "string";
+		case op_lookup: return "lookup";
+		case op_slot: return "slot";
+		case op_access: return "access";
+		case op_load: return "load";
+		case op_store: return "store";
+		case op_retain: return "retain";
+		case op_release: return "release";
+		case op_box: return "box";
+		case op_unbox: return "unbox";
+		case op_real_unary: return "real_unary";
+		case op_real_binary: return "real_binary";
+		case op_unary: return "unary";
+		case op_binary: return "binary";
+		case op_call: return "call";
+		case op_phi: return "phi";
+		case op_jump: return "jump";
+		case op_branch: return "branch";
+		case op_return: return "return";
+		case op_exit: return "exit";
+		}
+	}
+}
+
+std::ostream &operator <<(std::ostream &o, const ir_function &f) {
+	std::unordered_map<const void*, size_t> numbers;
+	for (auto &b : f.blocks) {
+		numbers.emplace(b.get(), numbers.size());
+		for (auto &inst : b->insts) numbers.emplace(inst.get(), numbers.size());
+	}
+
+	for (auto &b : f.blocks) {
+		o << b->label << numbers[b.get()] << ":\n";
+		for (auto &inst : b->insts) {
+			o << "\t";
+			if (inst->type != ir_void) o << "%" << numbers[inst.get()] << " = ";
+			o << opcode_name(inst->opcode);
+
+			switch (inst->opcode) {
+			default: break;
+
+			case op_real: o << " " << inst->real; break;
+			case op_string:
+				o << " \"" << std::string(inst->data, inst->length) << "\"";
+				break;
+			case op_lookup: case op_slot: case op_call:
+				o << " " << std::string(inst->name->data, inst->name->length);
+				break;
+			case op_real_unary: case op_real_binary:
+			case op_unary: case op_binary:
+				o << " " << inst->op;
+				break;
+			}
+			if (inst->lvalue) o << " lvalue";
+
+			for (size_t i = 0; i < inst->operands.size(); i++) {
+				o << (i ? ", " : " ") << "%" << numbers[inst->operands[i]];
+				if (inst->opcode == op_phi) {
+					ir_block *pred = inst->targets[i];
+					o << " from " << pred->label << numbers[pred];
+				}
+			}
+			if (inst->opcode != op_phi) {
+				for (ir_block *target : inst->targets)
+					o << " " << target->label << numbers[target];
+			}
+			o << "\n";
+		}
+	}
+
+	return o;
+}
+
+void ir_pass_manager::run(ir_function &f) {
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (auto &pass : passes) changed = pass->run(f) || changed;
+	}
+}
+
+namespace {
+	class redundant_lookups : public ir_pass {
+	public:
+		bool run(ir_function &f);
+
+	private:
+		// an instruction equivalent to inst that's still valid, if any
+		ir_inst *available(ir_inst *inst);
+
+		typedef std::pair<const void*, bool> key;
+		struct key_hash {
+			size_t operator()(const key &k) const {
+				return std::hash<const void*>()(k.first) ^ k.second;
+			}
+		};
+
+		// lookups by name and accesses by variable, each also by whether it
+		// was an lvalue. loads by address, which stores also make available
+		std::unordered_map<key, ir_inst*, key_hash> lookups;
+		std::unordered_map<key, ir_inst*, key_hash> accesses;
+		std::unordered_map<ir_inst*, ir_inst*> loads;
+	};
+
+	bool redundant_lookups::run(ir_function &f) {
+		bool changed = false;
+		for (auto &b : f.blocks) {
+			lookups.clear();
+			accesses.clear();
+			loads.clear();
+
+			auto &insts = b->insts;
+			for (size_t i = 0; i < insts.size(); ) {
+				ir_inst *inst = insts[i].get();
+				ir_inst *same = available(inst);
+				if (same) {
+					f.replace_uses(inst, same);
+					insts.erase(insts.begin() + i);
+					changed = true;
+					continue;
+				}
+
+				i++;
+			}
+		}
+
+		return changed;
+	}
+
+	// an rvalue can reuse an earlier lvalue, but not the other way around, since
+	// an lvalue may have to create its variable. once it has, a repeat can't
+	ir_inst *redundant_lookups::available(ir_inst *inst) {
+		switch (inst->opcode) {
+		default: return 0;
+
+		// a script may do anything, including moving variables
+		case op_call:
+			lookups.clear();
+			accesses.clear();
+			loads.clear();
+			return 0;
+
+		case op_lookup: {
+			key lvalue(inst->name, true), rvalue(inst->name, false);
+			auto same = lookups.find(lvalue);
+			if (same != lookups.end()) return same->second;
+			if (!inst->lvalue) {
+				same = lookups.find(rvalue);
+				if (same != lookups.end()) return same->second;
+				lookups[rvalue] = inst;
+				return 0;
+			}
+
+			// a new variable can make its instance's slots move
+			lookups.clear();
+			accesses.clear();
+			loads.clear();
+			lookups[lvalue] = lookups[rvalue] = inst;
+			return 0;
+		}
+
+		case op_access: {
+			ir_inst *var = inst->operands[0];
+			key lvalue(var, true), rvalue(var, false);
+			auto same = accesses.find(lvalue);
+			if (same != accesses.end()) return same->second;
+			if (!inst->lvalue) {
+				same = accesses.find(rvalue);
+				if (same != accesses.end()) return same->second;
+				accesses[rvalue] = inst;
+				return 0;
+			}
+
+			// growing a variable moves its elements
+			accesses.clear();
+			loads.clear();
+			accesses[lvalue] = accesses[rvalue] = inst;
+			return 0;
+		}
+
+		case op_load: {
+			ir_inst *address = inst->operands[0];
+			auto same = loads.find(address);
+			if (same != loads.end()) return same->second;
+			loads[address] = inst;
+			return 0;
+		}
+
+		// any other address may be the same variable
+		case op_store:
+			loads.clear();
+			loads[inst->operands[0]] = inst->operands[1];
+			return 0;
+		}
+	}
+
+	class dead_code : public ir_pass {
+	public:
+		bool run(ir_function &f);
+	};
+
+	bool dead_code::run(ir_function &f) {
+		bool changed = false;
+		for (bool removed = true; removed; ) {
+			removed = false;
+
+			// a phi that only feeds itself is still dead
+			std::unordered_map<ir_inst*, size_t> uses;
+			for (auto &b : f.blocks) {
+				for (auto &inst : b->insts) {
+					for (ir_inst *operand : inst->operands) {
+						if (operand != inst.get()) uses[operand]++;
+					}
+				}
+			}
+
+			for (auto &b : f.blocks) {
+				auto &insts = b->insts;
+				auto dead = std::remove_if(
+					insts.begin(), insts.end(),
+					[&](const std::unique_ptr<ir_inst> &inst) {
+						return inst->is_pure() && uses[inst.get()] == 0;
+					}
+				);
+				if (dead == insts.end()) continue;
+
+				insts.erase(dead, insts.end());
+				removed = changed = true;
+			}
+		}
+
+		return changed;
+	}
+}
+
+std::unique_ptr<ir_pass> create_redundant_lookups() {
+	return std::unique_ptr<ir_pass>(new redundant_lookups);
+}
+
+std::unique_ptr<ir_pass> create_dead_code() {
+	return std::unique_ptr<ir_pass>(new dead_code);
+}
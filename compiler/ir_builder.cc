@@ -0,0 +1,716 @@
+#include <dejavu/compiler/ir_builder.h>
+#include <dejavu/compiler/identifier.h>
+#include <algorithm>
+
+namespace {
+	// operators the runtime implements, see codegen's unary_name and binary_name
+	bool is_unary(token_type op) {
+		switch (op) {
+		default: return false;
+		case exclaim: case tilde: case minus: case plus: return true;
+		}
+	}
+
+	bool is_binary(token_type op) {
+		switch (op) {
+		default: return false;
+
+		case less: case less_equals: case is_equals: case not_equals:
+		case greater_equals: case greater:
+		case plus: case minus: case times: case divide:
+		case ampamp: case pipepipe: case caretcaret:
+		case bit_and: case bit_or: case bit_xor: case shift_left: case shift_right:
+		case kw_div: case kw_mod:
+			return true;
+		}
+	}
+}
+
+ir_builder::ir_builder(
+	identifier_pool &names, const type_inference &types,
+	const std::unordered_set<const identifier*> &slots
+) : types(types), slots(slots) {
+	argument_name = names.intern("argument", 8);
+	argument_count_name = names.intern("argument_count", 14);
+}
+
+bool ir_builder::build(node *body, ir_function &f) {
+	function = &f;
+	current = f.add_block("entry");
+	seal(current);
+
+	visit(body);
+	if (!supported) return false;
+
+	// scalars are released at the end even if their declaration never ran
+	for (const identifier *name : variants) {
+		add(op_release, ir_void, read_variable(name, current));
+	}
+	add(op_exit, ir_void);
+
+	for (auto &b : f.blocks) {
+		auto &insts = b->insts;
+		insts.erase(std::remove_if(
+			insts.begin(), insts.end(),
+			[&](const std::unique_ptr<ir_inst> &inst) {
+				return removed.find(inst.get()) != removed.end();
+			}
+		), insts.end());
+	}
+
+	return true;
+}
+
+ir_inst *ir_builder::visit_expression_error(expression_error*) {
+	return unsupported();
+}
+
+ir_inst *ir_builder::visit_value(value *v) {
+	switch (v->t.type) {
+	default: return unsupported();
+
+	case v_name: {
+		if (locals.find(v->t.name) != locals.end())
+			return read_variable(v->t.name, current);
+		return add(op_load, ir_variant, address_of(v->t.name, false));
+	}
+
+	case v_real: return add_real(v->t.real);
+	case v_string: {
+		ir_inst *s = add(op_string, ir_variant);
+		s->data = v->t.data;
+		s->length = v->t.length;
+		return s;
+	}
+
+	case kw_self: return add_real(-1);
+	case kw_other: return add_real(-2);
+	case kw_all: return add_real(-3);
+	case kw_noone: return add_real(-4);
+	case kw_global: return add_real(-5);
+	case kw_local: return add_real(-6);
+
+	case kw_true: return add_real(1);
+	case kw_false: return add_real(0);
+	}
+}
+
+ir_inst *ir_builder::visit_unary(unary *u) {
+	if (!is_unary(u->op)) return unsupported();
+
+	ir_inst *right = expression_value(u->right);
+	if (!right) return 0;
+
+	ir_inst *result = right->type == ir_real ?
+		add(op_real_unary, ir_real, right) :
+		add(op_unary, ir_variant, right);
+	result->op = u->op;
+	return result;
+}
+
+ir_inst *ir_builder::visit_binary(binary *b) {
+	if (b->op == dot || !is_binary(b->op)) return unsupported();
+	if (b->op == ampamp || b->op == pipepipe) return logical_value(b);
+
+	ir_inst *left = expression_value(b->left);
+	ir_inst *right = expression_value(b->right);
+	if (!left || !right) return 0;
+
+	ir_inst *result = left->type == ir_real && right->type == ir_real ?
+		add(op_real_binary, ir_real, left, right) :
+		add(op_binary, ir_variant, as_variant(left), as_variant(right));
+	result->op = b->op;
+	return result;
+}
+
+ir_inst *ir_builder::visit_subscript(subscript*) {
+	return unsupported();
+}
+
+ir_inst *ir_builder::visit_call(call *c) {
+	std::vector<ir_inst*> args;
+	for (expression **it = c->args.begin(); it != c->args.end(); ++it) {
+		args.push_back(as_variant(expression_value(*it)));
+	}
+
+	ir_inst *result = add(op_call, ir_variant);
+	result->name = c->function->t.name;
+	result->operands = args;
+	return result;
+}
+
+ir_inst *ir_builder::visit_statement_error(statement_error*) {
+	return unsupported();
+}
+
+ir_inst *ir_builder::visit_assignment(assignment *a) {
+	token_type op = unexpected;
+	switch (a->op) {
+	case plus_equals: op = plus; break;
+	case minus_equals: op = minus; break;
+	case times_equals: op = times; break;
+	case div_equals: op = divide; break;
+	case and_equals: op = bit_and; break;
+	case or_equals: op = bit_or; break;
+	case xor_equals: op = bit_xor; break;
+	default: /* should've already errored */ break;
+	}
+	binary b(op, a->lvalue, a->rvalue);
+
+	if (a->lvalue->type != value_node) return unsupported();
+	const token &t = static_cast<value*>(a->lvalue)->t;
+	if (t.type != v_name) return unsupported();
+
+	ir_inst *r = a->op == equals ? expression_value(a->rvalue) : visit_binary(&b);
+	if (!r) return 0;
+
+	// real locals are stored unboxed, and inference made sure the value is real
+	auto local = locals.find(t.name);
+	if (local != locals.end() && local->second == ir_real) {
+		write_variable(t.name, current, as_real(r));
+		return 0;
+	}
+
+	// the new value is retained first, in case it's the old one
+	r = as_variant(r);
+	if (local != locals.end()) {
+		ir_inst *old = read_variable(t.name, current);
+		add(op_retain, ir_void, r);
+		add(op_release, ir_void, old);
+		write_variable(t.name, current, r);
+		return 0;
+	}
+
+	ir_inst *address = address_of(t.name, true);
+	ir_inst *old = add(op_load, ir_variant, address);
+	add(op_retain, ir_void, r);
+	add(op_store, ir_void, address, r);
+	add(op_release, ir_void, old);
+	return 0;
+}
+
+ir_inst *ir_builder::visit_invocation(invocation *i) {
+	visit(i->c);
+	return 0;
+}
+
+// locals that need the runtime's var arrays stay on the ast path
+ir_inst *ir_builder::visit_declaration(declaration *d) {
+	if (d->type.type != kw_var) return unsupported();
+
+	for (value **it = d->names.begin(); it != d->names.end(); ++it) {
+		const identifier *name = (*it)->t.name;
+		if (
+			name == argument_name || name == argument_count_name ||
+			slots.find(name) != slots.end()
+		)
+			return unsupported();
+
+		if (locals.find(name) != locals.end()) continue;
+
+		ir_type type;
+		if (types.is_real(name)) type = ir_real;
+		else if (types.is_scalar(name)) type = ir_variant;
+		else return unsupported();
+
+		locals[name] = type;
+		if (type == ir_variant) variants.push_back(name);
+		declare(name, type);
+	}
+
+	return 0;
+}
+
+ir_inst *ir_builder::visit_block(block *b) {
+	for (statement **it = b->stmts.begin(); it != b->stmts.end(); ++it) {
+		if (!supported) break;
+		visit(*it);
+	}
+
+	return 0;
+}
+
+ir_inst *ir_builder::visit_ifstatement(ifstatement *i) {
+	ir_block *branch_true = function->add_block("then");
+	ir_block *branch_false = function->add_block("else");
+	ir_block *merge = function->add_block("merge");
+
+	condition(i->cond, branch_true, branch_false);
+	seal(branch_true);
+	seal(branch_false);
+
+	start(branch_true);
+	visit(i->branch_true);
+	jump_to(merge);
+
+	start(branch_false);
+	if (i->branch_false)
+		visit(i->branch_false);
+	jump_to(merge);
+
+	seal(merge);
+	start(merge);
+
+	return 0;
+}
+
+ir_inst *ir_builder::visit_whilestatement(whilestatement *w) {
+	ir_block *loop = function->add_block("loop");
+	ir_block *cond = function->add_block("cond");
+	ir_block *after = function->add_block("after");
+
+	jump_to(cond);
+
+	start(cond);
+	condition(w->cond, loop, after);
+	seal(loop);
+
+	start(loop);
+	{
+		ir_block *outer_loop = current_loop, *outer_end = current_end;
+		current_loop = cond;
+		current_end = after;
+		visit(w->stmt);
+		current_loop = outer_loop;
+		current_end = outer_end;
+	}
+	jump_to(cond);
+	seal(cond);
+	seal(after);
+
+	start(after);
+
+	return 0;
+}
+
+ir_inst *ir_builder::visit_dostatement(dostatement *d) {
+	ir_block *loop = function->add_block("loop");
+	ir_block *cond = function->add_block("cond");
+	ir_block *after = function->add_block("after");
+
+	jump_to(loop);
+
+	start(loop);
+	{
+		ir_block *outer_loop = current_loop, *outer_end = current_end;
+		current_loop = cond;
+		current_end = after;
+		visit(d->stmt);
+		current_loop = outer_loop;
+		current_end = outer_end;
+	}
+	jump_to(cond);
+	seal(cond);
+
+	start(cond);
+	condition(d->cond, after, loop);
+	seal(loop);
+	seal(after);
+
+	start(after);
+
+	return 0;
+}
+
+// the count is an ssa variable of its own, keyed by the statement
+ir_inst *ir_builder::visit_repeatstatement(repeatstatement *r) {
+	ir_block *cond = function->add_block("cond");
+	ir_block *loop = function->add_block("loop");
+	ir_block *next = function->add_block("next");
+	ir_block *after = function->add_block("after");
+
+	ir_inst *end = as_real(expression_value(r->expr));
+	variable_types[r] = ir_real;
+	write_variable(r, current, add_real(0));
+	jump_to(cond);
+
+	start(cond);
+	ir_inst *less_than = add(op_real_binary, ir_real, read_variable(r, cond), end);
+	less_than->op = less;
+	branch(less_than, loop, after);
+	seal(loop);
+
+	start(loop);
+	{
+		ir_block *outer_loop = current_loop, *outer_end = current_end;
+		current_loop = next;
+		current_end = after;
+		visit(r->stmt);
+		current_loop = outer_loop;
+		current_end = outer_end;
+	}
+	jump_to(next);
+	seal(next);
+
+	start(next);
+	ir_inst *inc = add(op_real_binary, ir_real, read_variable(r, next), add_real(1));
+	inc->op = plus;
+	write_variable(r, next, inc);
+	jump_to(cond);
+	seal(cond);
+	seal(after);
+
+	start(after);
+
+	return 0;
+}
+
+ir_inst *ir_builder::visit_forstatement(forstatement *f) {
+	ir_block *loop = function->add_block("loop");
+	ir_block *cond = function->add_block("cond");
+	ir_block *inc = function->add_block("inc");
+	ir_block *after = function->add_block("after");
+
+	visit(f->init);
+	jump_to(cond);
+
+	start(cond);
+	condition(f->cond, loop, after);
+	seal(loop);
+
+	start(loop);
+	{
+		ir_block *outer_loop = current_loop, *outer_end = current_end;
+		current_loop = inc;
+		current_end = after;
+		visit(f->stmt);
+		current_loop = outer_loop;
+		current_end = outer_end;
+	}
+	jump_to(inc);
+	seal(inc);
+
+	start(inc);
+	visit(f->inc);
+	jump_to(cond);
+	seal(cond);
+	seal(after);
+
+	start(after);
+
+	return 0;
+}
+
+// todo: switch and with
+ir_inst *ir_builder::visit_switchstatement(switchstatement*) {
+	return unsupported();
+}
+
+ir_inst *ir_builder::visit_withstatement(withstatement*) {
+	return unsupported();
+}
+
+ir_inst *ir_builder::visit_casestatement(casestatement*) {
+	return unsupported();
+}
+
+ir_inst *ir_builder::visit_jump(jump *j) {
+	switch (j->type) {
+	default: return 0;
+
+	case kw_exit: add(op_return, ir_void); break;
+	case kw_break:
+		if (current_end) jump_to(current_end);
+		else add(op_return, ir_void);
+		break;
+	case kw_continue:
+		if (current_loop) jump_to(current_loop);
+		else add(op_return, ir_void);
+		break;
+	}
+
+	ir_block *cont = function->add_block("cont");
+	seal(cont);
+	start(cont);
+
+	return 0;
+}
+
+ir_inst *ir_builder::visit_returnstatement(returnstatement *r) {
+	add(op_return, ir_void, as_variant(expression_value(r->expr)));
+
+	ir_block *cont = function->add_block("cont");
+	seal(cont);
+	start(cont);
+
+	return 0;
+}
+
+ir_inst *ir_builder::add(ir_opcode opcode, ir_type type) {
+	ir_inst *inst = new ir_inst(opcode, type);
+	inst->parent = current;
+	current->insts.emplace_back(inst);
+	return inst;
+}
+
+ir_inst *ir_builder::add(ir_opcode opcode, ir_type type, ir_inst *a, ir_inst *b) {
+	ir_inst *inst = add(opcode, type);
+	inst->operands.push_back(a);
+	if (b) inst->operands.push_back(b);
+	return inst;
+}
+
+ir_inst *ir_builder::add_real(double real) {
+	ir_inst *inst = add(op_real, ir_real);
+	inst->real = real;
+	return inst;
+}
+
+ir_inst *ir_builder::unsupported() {
+	supported = false;
+	return 0;
+}
+
+ir_inst *ir_builder::expression_value(expression *e) {
+	ir_inst *v = visit(e);
+	if (!v) supported = false;
+	return v;
+}
+
+ir_inst *ir_builder::as_real(ir_inst *v) {
+	if (!v || v->type == ir_real) return v;
+	return add(op_unbox, ir_real, v);
+}
+
+ir_inst *ir_builder::as_variant(ir_inst *v) {
+	if (!v || v->type == ir_variant) return v;
+	return add(op_box, ir_variant, v);
+}
+
+ir_inst *ir_builder::address_of(const identifier *name, bool lvalue) {
+	if (slots.find(name) != slots.end()) {
+		ir_inst *slot = add(op_slot, ir_address);
+		slot->name = name;
+		return slot;
+	}
+
+	// codegen reads the rest of argument# out of the argument array
+	if (is_numbered_argument(name)) return unsupported();
+
+	ir_inst *var = add(op_lookup, ir_var);
+	var->name = name;
+	var->lvalue = lvalue;
+
+	ir_inst *element = add(op_access, ir_address, var);
+	element->lvalue = lvalue;
+	return element;
+}
+
+// edges out of unreachable code aren't predecessors, so phis never merge in
+// values from it. every block is started after an edge into it from earlier
+// code, except loop headers, so a block with no predecessors by the time it
+// ends can never be reached
+void ir_builder::jump_to(ir_block *target) {
+	ir_inst *inst = add(op_jump, ir_void);
+	inst->targets.push_back(target);
+	if (is_reachable()) target->preds.push_back(current);
+}
+
+void ir_builder::branch(ir_inst *cond, ir_block *t, ir_block *f) {
+	ir_inst *inst = add(op_branch, ir_void, cond);
+	inst->targets.push_back(t);
+	inst->targets.push_back(f);
+	if (is_reachable()) {
+		t->preds.push_back(current);
+		f->preds.push_back(current);
+	}
+}
+
+// && and || only evaluate their right operand when it decides the result
+// conditions are true over 0.5, and operands of the logical operators when
+// they're nonzero, the same as codegen's
+void ir_builder::condition(
+	expression *cond, ir_block *t, ir_block *f, bool nonzero
+) {
+	if (cond->type == unary_node && static_cast<unary*>(cond)->op == exclaim) {
+		condition(static_cast<unary*>(cond)->right, f, t, true);
+		return;
+	}
+
+	if (cond->type == binary_node) {
+		binary *b = static_cast<binary*>(cond);
+		if (b->op == ampamp || b->op == pipepipe) {
+			ir_block *right = function->add_block(b->op == ampamp ? "and" : "or");
+			if (b->op == ampamp) condition(b->left, right, f, true);
+			else condition(b->left, t, right, true);
+			seal(right);
+
+			start(right);
+			condition(b->right, t, f, true);
+			return;
+		}
+	}
+
+	ir_inst *v = as_real(expression_value(cond));
+	if (v && nonzero) {
+		v = add(op_real_binary, ir_real, v, add_real(0));
+		v->op = not_equals;
+	}
+	branch(v, t, f);
+}
+
+// the result is an ssa variable of its own, keyed by the operator's node
+ir_inst *ir_builder::logical_value(binary *b) {
+	ir_block *yes = function->add_block("true");
+	ir_block *no = function->add_block("false");
+	ir_block *merge = function->add_block("merge");
+
+	condition(b, yes, no);
+	seal(yes);
+	seal(no);
+
+	variable_types[b] = ir_real;
+	start(yes);
+	write_variable(b, yes, add_real(1));
+	jump_to(merge);
+
+	start(no);
+	write_variable(b, no, add_real(0));
+	jump_to(merge);
+
+	seal(merge);
+	start(merge);
+	return read_variable(b, merge);
+}
+
+bool ir_builder::is_reachable() const {
+	return current == function->entry() || !current->preds.empty();
+}
+
+void ir_builder::start(ir_block *b) {
+	current = b;
+}
+
+// locals start out as 0, like the allocas codegen initializes up front
+void ir_builder::declare(const void *key, ir_type type) {
+	variable_types[key] = type;
+	write_variable(key, function->entry(), zero(type));
+}
+
+void ir_builder::write_variable(const void *key, ir_block *b, ir_inst *value) {
+	defs[key][b] = value;
+}
+
+ir_inst *ir_builder::read_variable(const void *key, ir_block *b) {
+	auto &blocks = defs[key];
+	auto def = blocks.find(b);
+	if (def != blocks.end()) return def->second;
+
+	return read_variable_recursive(key, b);
+}
+
+ir_inst *ir_builder::read_variable_recursive(const void *key, ir_block *b) {
+	ir_inst *value;
+	if (sealed.find(b) == sealed.end()) {
+		value = add_phi(key, b);
+		incomplete[b].emplace_back(key, value);
+	}
+	else if (b->preds.empty()) {
+		// only unreachable code gets here
+		value = zero(variable_types[key]);
+	}
+	else if (b->preds.size() == 1) {
+		value = read_variable(key, b->preds[0]);
+	}
+	else {
+		// the phi breaks cycles through loops
+		ir_inst *phi = add_phi(key, b);
+		write_variable(key, b, phi);
+		value = add_phi_operands(key, phi);
+	}
+
+	write_variable(key, b, value);
+	return value;
+}
+
+ir_inst *ir_builder::add_phi(const void *key, ir_block *b) {
+	ir_inst *phi = new ir_inst(op_phi, variable_types[key]);
+	phi->parent = b;
+	pending.insert(phi);
+
+	auto &insts = b->insts;
+	auto it = std::find_if(
+		insts.begin(), insts.end(),
+		[](const std::unique_ptr<ir_inst> &inst) { return inst->opcode != op_phi; }
+	);
+	insts.emplace(it, phi);
+	return phi;
+}
+
+ir_inst *ir_builder::add_phi_operands(const void *key, ir_inst *phi) {
+	for (ir_block *pred : phi->parent->preds) {
+		phi->operands.push_back(read_variable(key, pred));
+		phi->targets.push_back(pred);
+	}
+	pending.erase(phi);
+
+	return remove_trivial_phi(phi);
+}
+
+// a phi whose operands are all the same value, or itself, is just that value
+ir_inst *ir_builder::remove_trivial_phi(ir_inst *phi) {
+	ir_inst *same = 0;
+	for (ir_inst *operand : phi->operands) {
+		if (operand == same || operand == phi) continue;
+		if (same) return phi;
+		same = operand;
+	}
+	if (!same) same = zero(phi->type);
+
+	std::vector<ir_inst*> users;
+	for (auto &b : function->blocks) {
+		for (auto &inst : b->insts) {
+			if (inst.get() == phi || inst->opcode != op_phi) continue;
+
+			auto &operands = inst->operands;
+			if (std::find(operands.begin(), operands.end(), phi) != operands.end())
+				users.push_back(inst.get());
+		}
+	}
+
+	function->replace_uses(phi, same);
+	for (auto &blocks : defs) {
+		for (auto &def : blocks.second) {
+			if (def.second == phi) def.second = same;
+		}
+	}
+	removed.insert(phi);
+
+	// phis that are still missing operands are checked once they have them
+	for (ir_inst *user : users) {
+		if (
+			removed.find(user) == removed.end() &&
+			pending.find(user) == pending.end()
+		)
+			remove_trivial_phi(user);
+	}
+
+	return same;
+}
+
+// constants for the entry block, which dominates everything
+ir_inst *ir_builder::zero(ir_type type) {
+	auto &insts = function->entry()->insts;
+
+	ir_inst *real = new ir_inst(op_real, ir_real);
+	real->parent = function->entry();
+	insts.emplace(insts.begin(), real);
+	if (type == ir_real) return real;
+
+	ir_inst *box = new ir_inst(op_box, ir_variant);
+	box->parent = function->entry();
+	box->operands.push_back(real);
+	insts.emplace(insts.begin() + 1, box);
+	return box;
+}
+
+// a block is sealed once all of its predecessors are known
+void ir_builder::seal(ir_block *b) {
+	auto phis = std::move(incomplete[b]);
+	incomplete.erase(b);
+
+	for (auto &phi : phis) {
+		add_phi_operands(phi.first, phi.second);
+	}
+	sealed.insert(b);
+}
@@ -0,0 +1,163 @@
+#include <dejavu/compiler/codegen.h>
+#include <dejavu/compiler/ir_builder.h>
+#include <llvm/IR/Constants.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+// builds, optimizes and lowers the ir for a function body, or returns false
+// without generating anything if the ir can't express it
+bool node_codegen::build_ir(node *body) {
+	std::unordered_set<const identifier*> slots;
+	for (auto &scalar : scalars) slots.insert(scalar.first);
+
+	ir_function f;
+	if (!ir_builder(names, types, slots).build(body, f)) return false;
+
+	ir_passes.run(f);
+	lower(f);
+	return true;
+}
+
+// the entry block continues wherever add_function is, and exit falls through
+// to the epilogue add_function emits after the body
+void node_codegen::lower(ir_function &f) {
+	Function *function = builder.GetInsertBlock()->getParent();
+	LLVMContext &context = function->getContext();
+
+	// unreachable blocks are dropped, and no phi has an edge from one
+	std::vector<ir_block*> order = f.reverse_postorder();
+	std::unordered_map<const ir_block*, BasicBlock*> blocks, ends;
+	for (ir_block *b : order) {
+		blocks[b] = b == f.entry() ?
+			builder.GetInsertBlock() : BasicBlock::Create(context, b->label);
+	}
+	BasicBlock *epilogue = BasicBlock::Create(context, "epilogue");
+
+	std::unordered_map<const ir_inst*, Value*> values;
+	std::vector<const ir_inst*> phis;
+	for (ir_block *b : order) {
+		if (b != f.entry()) {
+			function->getBasicBlockList().push_back(blocks[b]);
+			builder.SetInsertPoint(blocks[b]);
+		}
+
+		for (auto &i : b->insts) {
+			const ir_inst *inst = i.get();
+			auto operand = [&](size_t n) { return values[inst->operands[n]]; };
+
+			Value *v = 0;
+			switch (inst->opcode) {
+			case op_real: v = ConstantFP::get(real_type, inst->real); break;
+			case op_string: {
+				Value *s = intern_string(StringRef(inst->data, inst->length));
+				v = builder.CreateInsertValue(
+					UndefValue::get(ret_type), builder.getInt8(1), 0
+				);
+				v = builder.CreateInsertValue(
+					v, builder.CreatePtrToInt(s, builder.getInt64Ty()), 1
+				);
+				break;
+			}
+
+			case op_lookup: {
+				auto local = scope.find(inst->name);
+				v = local != scope.end() ? local->second : 0;
+				if (!v) v = get_self_slot(inst->name);
+				if (!v) v = do_lookup_default(inst->name, inst->lvalue);
+				break;
+			}
+			case op_slot: v = scalars[inst->name]; break;
+			case op_access:
+				v = do_access(
+					operand(0), builder.getInt16(0), builder.getInt16(0), inst->lvalue
+				);
+				break;
+			case op_load: v = load_variant(operand(0)); break;
+			case op_store: store_variant(operand(0), operand(1)); break;
+
+			case op_retain: builder.CreateCall(retain, spill(operand(0))); break;
+			case op_release: builder.CreateCall(release, spill(operand(0))); break;
+
+			case op_box:
+				v = builder.CreateInsertValue(
+					UndefValue::get(ret_type), builder.getInt8(0), 0
+				);
+				v = builder.CreateInsertValue(
+					v, builder.CreateBitCast(operand(0), builder.getInt64Ty()), 1
+				);
+				break;
+			case op_unbox: v = variant_real(spill(operand(0))); break;
+
+			case op_real_unary: v = real_unary(inst->op, operand(0)); break;
+			case op_real_binary:
+				v = real_binary(inst->op, operand(0), operand(1));
+				break;
+
+			case op_unary: case op_binary: {
+				bool strings = false;
+				for (const ir_inst *o : inst->operands)
+					strings = strings || o->opcode == op_string;
+
+				Value *l = spill(operand(0));
+				Value *r = inst->opcode == op_binary ? spill(operand(1)) : 0;
+				v = load_variant(operator_call(inst->op, l, r, strings, false));
+				break;
+			}
+
+			case op_call: {
+				std::vector<Value*> args;
+				for (size_t n = 0; n < inst->operands.size(); n++)
+					args.push_back(operand(n));
+				v = call_function(inst->name, args);
+				break;
+			}
+
+			// incoming values may not be lowered yet, so they're added last
+			case op_phi:
+				v = builder.CreatePHI(
+					inst->type == ir_real ? real_type : ret_type,
+					inst->operands.size()
+				);
+				phis.push_back(inst);
+				break;
+
+			case op_jump: builder.CreateBr(blocks[inst->targets[0]]); break;
+			case op_branch:
+				builder.CreateCondBr(
+					builder.CreateFCmpUGT(operand(0), ConstantFP::get(real_type, 0.5)),
+					blocks[inst->targets[0]], blocks[inst->targets[1]]
+				);
+				break;
+			case op_return:
+				builder.CreateRet(
+					inst->operands.empty() ? load_variant(return_value) : operand(0)
+				);
+				break;
+			case op_exit: builder.CreateBr(epilogue); break;
+			}
+
+			values[inst] = v;
+		}
+
+		// operators may have split the block
+		ends[b] = builder.GetInsertBlock();
+	}
+
+	for (const ir_inst *inst : phis) {
+		PHINode *phi = cast<PHINode>(values[inst]);
+		for (size_t n = 0; n < inst->operands.size(); n++)
+			phi->addIncoming(values[inst->operands[n]], ends[inst->targets[n]]);
+	}
+
+	function->getBasicBlockList().push_back(epilogue);
+	builder.SetInsertPoint(epilogue);
+}
+
+// a variant value in memory, for runtime functions that take a pointer
+Value *node_codegen::spill(Value *val) {
+	Value *variant = alloc(variant_type);
+	store_variant(variant, val);
+	return variant;
+}
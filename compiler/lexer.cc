@@ -1,15 +1,18 @@
 #include <dejavu/compiler/lexer.h>
+#include <dejavu/compiler/identifier.h>
 #include <dejavu/system/buffer.h>
+#include <algorithm>
 #include <cstdlib>
-#include <map>
+#include <cstring>
 #include <sstream>
-#include <string>
+
+#if defined(__SSE2__) && !defined(DEJAVU_NO_SIMD)
+#include <immintrin.h>
+#define LEXER_SIMD
+#endif
 
 namespace {
 
-bool isspace(char c) {
-	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
-}
 bool isnewline(char c) {
 	return c == '\n' || c == '\r';
 }
@@ -38,25 +41,189 @@ bool isdigit(char c) {
 	return '0' <= c && c <= '9';
 }
 
-struct keyword_table : public std::map<std::string, token_type> {
-	keyword_table();
-} keywords;
-
-keyword_table::keyword_table() {
-	keywords["begin"] = l_brace;
-	keywords["end"] = r_brace;
-	keywords["not"] = exclaim;
-	keywords["and"] = ampamp;
-	keywords["or"] = pipepipe;
-	keywords["xor"] = caretcaret;
-#	define KEYWORD(X) keywords[#X] = kw_ ## X;
-#	include "dejavu/compiler/tokens.tbl"
+// character classes for scan(), testing either one char or a vector of them
+#ifdef LEXER_SIMD
+__m128i splat(__m128i, char c) { return _mm_set1_epi8(c); }
+__m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi8(a, b); }
+__m128i gt(__m128i a, __m128i b) { return _mm_cmpgt_epi8(a, b); }
+__m128i both(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+__m128i either(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+__m128i invert(__m128i a) { return _mm_xor_si128(a, _mm_set1_epi8(-1)); }
+__m128i neither(__m128i a, __m128i b) { return invert(either(a, b)); }
+unsigned mask(__m128i a) { return _mm_movemask_epi8(a); }
+
+#ifdef __AVX2__
+__m256i splat(__m256i, char c) { return _mm256_set1_epi8(c); }
+__m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi8(a, b); }
+__m256i gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi8(a, b); }
+__m256i both(__m256i a, __m256i b) { return _mm256_and_si256(a, b); }
+__m256i either(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+__m256i invert(__m256i a) { return _mm256_xor_si256(a, _mm256_set1_epi8(-1)); }
+__m256i neither(__m256i a, __m256i b) { return invert(either(a, b)); }
+unsigned mask(__m256i a) { return _mm256_movemask_epi8(a); }
+#endif
+#endif
+
+struct space_class {
+	bool operator()(char c) const { return c == ' ' || c == '\t' || isnewline(c); }
+
+	template <typename V>
+	V operator()(V v) const {
+		return either(
+			either(eq(v, splat(v, ' ')), eq(v, splat(v, '\t'))),
+			either(eq(v, splat(v, '\n')), eq(v, splat(v, '\r')))
+		);
+	}
+};
+
+struct name_class {
+	bool operator()(char c) const { return isname(c); }
+
+	// (c | 0x20) folds A-Z onto a-z without moving anything else into a-z
+	// all the characters involved are ASCII, so signed compares are fine
+	template <typename V>
+	V operator()(V v) const {
+		V lower = either(v, splat(v, 0x20));
+		V alpha = both(gt(lower, splat(v, 'a' - 1)), gt(splat(v, 'z' + 1), lower));
+		V digit = both(gt(v, splat(v, '0' - 1)), gt(splat(v, '9' + 1), v));
+		return either(either(alpha, digit), eq(v, splat(v, '_')));
+	}
+};
+
+struct line_class {
+	bool operator()(char c) const { return !isnewline(c); }
+
+	template <typename V>
+	V operator()(V v) const {
+		return neither(eq(v, splat(v, '\n')), eq(v, splat(v, '\r')));
+	}
+};
+
+// everything up to a given char, like the end of a string or comment
+struct until_class {
+	until_class(char stop) : stop(stop) {}
+	char stop;
+
+	bool operator()(char c) const { return c != stop; }
+
+	template <typename V>
+	V operator()(V v) const { return invert(eq(v, splat(v, stop))); }
+};
+
+// returns the number of chars at the start of [p, end) that are in a class
+// this is where the lexer spends its time on comments, strings and names
+template <typename C>
+size_t scan(const char *p, const char *end, C in_class) {
+	const char *start = p;
+
+#ifdef LEXER_SIMD
+#ifdef __AVX2__
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		unsigned out = ~mask(in_class(v));
+		if (out) return p - start + __builtin_ctz(out);
+	}
+#endif
+
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		unsigned out = ~mask(in_class(v)) & 0xffff;
+		if (out) return p - start + __builtin_ctz(out);
+	}
+#endif
+
+	while (p != end && in_class(*p)) p++;
+	return p - start;
+}
+
+// keywords are recognized with a perfect hash table built at compile time
+struct keyword {
+	const char *name;
+	size_t length;
+	token_type type;
+};
+
+constexpr keyword keywords[] = {
+	{ "begin", 5, l_brace },
+	{ "end", 3, r_brace },
+	{ "not", 3, exclaim },
+	{ "and", 3, ampamp },
+	{ "or", 2, pipepipe },
+	{ "xor", 3, caretcaret },
+#	define KEYWORD(X) { #X, sizeof(#X) - 1, kw_ ## X },
+#	include <dejavu/compiler/tokens.tbl>
+};
+
+constexpr size_t num_keywords = sizeof(keywords) / sizeof(*keywords);
+constexpr size_t keyword_slots = 128;
+
+constexpr size_t max_keyword_length() {
+	size_t m = 0;
+	for (size_t i = 0; i < num_keywords; i++) {
+		if (keywords[i].length > m) m = keywords[i].length;
+	}
+	return m;
 }
 
+constexpr unsigned hash_keyword(const char *data, size_t length, unsigned seed) {
+	unsigned h = seed;
+	for (size_t i = 0; i < length; i++) {
+		h = (h ^ static_cast<unsigned char>(data[i])) * 16777619u;
+	}
+	return (h ^ (h >> 15)) % keyword_slots;
 }
 
-token_stream::token_stream(buffer &b) :
-	row(1), col(1), current(b.begin()), buffer_end(b.end()) {
+// each slot holds an index into keywords, plus one so zero means empty
+struct keyword_table {
+	unsigned seed;
+	unsigned char slots[keyword_slots];
+};
+
+constexpr bool fill_keyword_table(keyword_table &table) {
+	for (size_t i = 0; i < keyword_slots; i++) table.slots[i] = 0;
+
+	for (size_t i = 0; i < num_keywords; i++) {
+		const keyword &k = keywords[i];
+		unsigned h = hash_keyword(k.name, k.length, table.seed);
+		if (table.slots[h]) return false;
+		table.slots[h] = i + 1;
+	}
+
+	return true;
+}
+
+// searches for a seed that gives each keyword its own slot
+constexpr keyword_table build_keyword_table() {
+	keyword_table table = {};
+	for (table.seed = 2166136261u; table.seed < 2166136261u + 1000; table.seed++) {
+		if (fill_keyword_table(table)) return table;
+	}
+
+	table.seed = 0;
+	return table;
+}
+
+constexpr keyword_table keyword_hash = build_keyword_table();
+static_assert(keyword_hash.seed != 0, "no perfect hash for the keyword table");
+
+token_type find_keyword(const char *data, size_t length) {
+	if (length > max_keyword_length()) return v_name;
+
+	unsigned h = hash_keyword(data, length, keyword_hash.seed);
+	unsigned char slot = keyword_hash.slots[h];
+	if (!slot) return v_name;
+
+	const keyword &k = keywords[slot - 1];
+	if (k.length != length || memcmp(k.name, data, length) != 0) return v_name;
+
+	return k.type;
+}
+
+}
+
+token_stream::token_stream(buffer &b, identifier_pool &names) :
+	buffer_begin(b.begin()), current(b.begin()), buffer_end(b.end()),
+	names(names) {
 }
 
 token token_stream::gettoken() {
@@ -81,72 +248,84 @@ token token_stream::gettoken() {
 
 	// eof
 	if (current == buffer_end) {
-		return token(eof, row, col);
+		return token(eof, offset());
 	}
 
 	// error
-	token u = token(unexpected, row, ++col);
-	u.string.data = current++; u.string.length = 1;
+	token u = token(unexpected, offset(), 1);
+	u.data = current++;
 	return u;
 }
 
+// works out the row and column of a token, counting tabs as four columns
+// this is only needed for diagnostics, so lines are indexed on demand
+source_location token_stream::locate(const token &t) {
+	if (lines.empty()) {
+		lines.push_back(0);
+
+		const char *p = buffer_begin;
+		while (true) {
+			p += scan(p, buffer_end, line_class());
+			if (p == buffer_end) break;
+
+			if (*p == '\r' && p + 1 != buffer_end && *(p + 1) == '\n') p++;
+			p++;
+
+			lines.push_back(p - buffer_begin);
+		}
+	}
+
+	auto line = std::upper_bound(lines.begin(), lines.end(), t.position) - 1;
+
+	size_t col = 1;
+	for (const char *p = buffer_begin + *line; p < buffer_begin + t.position; p++) {
+		col += *p == '\t' ? 4 : 1;
+	}
+
+	return { size_t(line - lines.begin()) + 1, col };
+}
+
+uint32_t token_stream::offset() const {
+	return current - buffer_begin;
+}
+
 // skips any whitespace or comments at the current position
 void token_stream::skipwhitespace() {
-	for (; current != buffer_end; current++) {
-		if (*current == '\t') {
-			col += 4;
-		}
-		else if (isnewline(*current)) {
-			skipnewline();
-		}
-		else if (isspace(*current)) {
-			col += 1;
-		}
-		else if (*current == '/') {
-			if (skipcomment()) {
-				if (current == buffer_end) {
-					break;
-				}
-			}
-			else {
-				break;
-			}
-		}
-		else {
+	while (current != buffer_end) {
+		current += scan(current, buffer_end, space_class());
+
+		if (current == buffer_end || *current != '/' || !skipcomment()) {
 			break;
 		}
 	}
 }
 
+// skips a comment at the current position, leaving any newline after it
 bool token_stream::skipcomment() {
+	if (current + 1 == buffer_end) {
+		return false;
+	}
+
 	// single-line comment
 	if (*(current + 1) == '/') {
 		current += 2;
-
-		for (; current != buffer_end; current++) {
-			if (isnewline(*current)) {
-				break;
-			}
-		}
-
+		current += scan(current, buffer_end, line_class());
 		return true;
 	}
 	// multi-line comment
 	else if (*(current + 1) == '*') {
 		current += 2;
-		col += 2;
 
-		for (; current != buffer_end; current++) {
-			if (*current == '*' && *(current + 1) == '/') {
-				current++;
-				col += 2;
+		while (current != buffer_end) {
+			current += scan(current, buffer_end, until_class('*'));
+			if (current == buffer_end) {
 				break;
 			}
-			else if (isnewline(*current)) {
-				skipnewline();
-			}
-			else {
-				col += 1;
+
+			current++;
+			if (current != buffer_end && *current == '/') {
+				current++;
+				break;
 			}
 		}
 
@@ -156,35 +335,27 @@ bool token_stream::skipcomment() {
 	return false;
 }
 
-// skips a newline at the current position
-// does NOT update current for single-char newlines
-// if there's no newline, behavior is undefined
-void token_stream::skipnewline() {
-	row += 1;
-	col = 1;
-
-	if (*current == '\r' && *(current + 1) == '\n') {
-		current++;
-	}
-}
-
 // returns the name or keyword at the current position
 // if there is none, behavior is undefined
 token token_stream::getname() {
-	token t(v_name, row, col);
-	t.string.data = current;
+	token t(v_name, offset());
+	t.data = current;
 
-	do {
-		current++;
-	} while (isname(*current));
-	t.string.length = current - t.string.data;
+	current++;
+	current += scan(current, buffer_end, name_class());
 
-	col += t.string.length;
+	size_t length = current - t.data;
+	if (length > max_token_length) {
+		t.type = unexpected;
+		t.length = 1;
+		return t;
+	}
 
-	// todo: figure out a better way than constructing an std::string?
-	std::string key = std::string(t.string.data, t.string.length);
-	if (keywords.count(key))
-		t.type = keywords[key];
+	t.length = length;
+	t.type = find_keyword(t.data, t.length);
+	if (t.type == v_name) {
+		t.name = names.intern(t.data, t.length);
+	}
 
 	return t;
 }
@@ -192,11 +363,11 @@ token token_stream::getname() {
 // returns the operator token at the current position
 // if there is none, behavior is undefined
 token token_stream::getoperator() {
-	token t(unexpected, row, col);
+	token t(unexpected, offset(), 1);
+	t.data = current;
 
 	// todo: can we use tokens.tbl here for maintainability? it just
 	// needs to be put in the right order for e.g. a regex parser
-	col++;
 	char c = *current++;
 	switch (c) {
 	case '{': t.type = l_brace; return t;
@@ -211,7 +382,7 @@ token token_stream::getoperator() {
 	case ';': t.type = semicolon; return t;
 	case ':':
 		switch (*current) {
-		case '=': col++; current++; t.type = equals; return t;
+		case '=': t.length++; current++; t.type = equals; return t;
 		default: t.type = colon; return t;
 		}
 
@@ -219,64 +390,64 @@ token token_stream::getoperator() {
 
 	case '=':
 		switch (*current) {
-		case '=': col++; current++; t.type = is_equals; return t;
+		case '=': t.length++; current++; t.type = is_equals; return t;
 		default: t.type = equals; return t;
 		}
 	case '!':
 		switch (*current) {
-		case '=': col++; current++; t.type = not_equals; return t;
+		case '=': t.length++; current++; t.type = not_equals; return t;
 		default: t.type = exclaim; return t;
 		}
 	case '<':
 		switch (*current) {
-		case '<': col++; current++; t.type = shift_left; return t;
-		case '=': col++; current++; t.type = less_equals; return t;
+		case '<': t.length++; current++; t.type = shift_left; return t;
+		case '=': t.length++; current++; t.type = less_equals; return t;
 		default: t.type = less; return t;
 		}
 	case '>':
 		switch (*current) {
-		case '>': col++; current++; t.type = shift_right; return t;
-		case '=': col++; current++; t.type = greater_equals; return t;
+		case '>': t.length++; current++; t.type = shift_right; return t;
+		case '=': t.length++; current++; t.type = greater_equals; return t;
 		default: t.type = greater; return t;
 		}
 
 	case '+':
 		switch (*current) {
-		case '=': col++; current++; t.type = plus_equals; return t;
+		case '=': t.length++; current++; t.type = plus_equals; return t;
 		default: t.type = plus; return t;
 		}
 	case '-':
 		switch (*current) {
-		case '=': col++; current++; t.type = minus_equals; return t;
+		case '=': t.length++; current++; t.type = minus_equals; return t;
 		default: t.type = minus; return t;
 		}
 	case '*':
 		switch (*current) {
-		case '=': col++; current++; t.type = times_equals; return t;
+		case '=': t.length++; current++; t.type = times_equals; return t;
 		default: t.type = times; return t;
 		}
 	case '/':
 		switch (*current) {
-		case '=': col++; current++; t.type = div_equals; return t;
+		case '=': t.length++; current++; t.type = div_equals; return t;
 		default: t.type = divide; return t;
 		}
 
 	case '&':
 		switch (*current) {
-		case '=': col++; current++; t.type = and_equals; return t;
-		case '&': col++; current++; t.type = ampamp; return t;
+		case '=': t.length++; current++; t.type = and_equals; return t;
+		case '&': t.length++; current++; t.type = ampamp; return t;
 		default: t.type = bit_and; return t;
 		}
 	case '|':
 		switch (*current) {
-		case '=': col++; current++; t.type = or_equals; return t;
-		case '|': col++; current++; t.type = pipepipe; return t;
+		case '=': t.length++; current++; t.type = or_equals; return t;
+		case '|': t.length++; current++; t.type = pipepipe; return t;
 		default: t.type = bit_or; return t;
 		}
 	case '^':
 		switch (*current) {
-		case '=': col++; current++; t.type = xor_equals; return t;
-		case '^': col++; current++; t.type = caretcaret; return t;
+		case '=': t.length++; current++; t.type = xor_equals; return t;
+		case '^': t.length++; current++; t.type = caretcaret; return t;
 		default: t.type = bit_xor; return t;
 		}
 
@@ -287,7 +458,7 @@ token token_stream::getoperator() {
 // returns the number at the current position
 // if there is none, behavior is undefined
 token token_stream::getnumber() {
-	token t(v_real, row, col);
+	token t(v_real, offset());
 
 	char *end;
 	if (*current == '$')
@@ -295,7 +466,7 @@ token token_stream::getnumber() {
 	else
 		t.real = strtod(current, &end);
 
-	col += end - current;
+	t.length = end - current;
 	current = end;
 
 	return t;
@@ -305,24 +476,24 @@ token token_stream::getnumber() {
 // GML makes this easy without escape sequences but we'll want them later
 // todo: error on unterminated strings
 token token_stream::getstring() {
-	token t(v_string, row, col);
+	token t(v_string, offset());
 
 	char delim = *current++;
-	col += 1;
 
-	t.string.data = current;
-	while (current != buffer_end && *current != delim) {
-		if (isnewline(*current))
-			skipnewline();
+	t.data = current;
+	current += scan(current, buffer_end, until_class(delim));
 
-		current++;
-		col += 1;
-	}
-	t.string.length = current - t.string.data;
+	size_t length = current - t.data;
+	if (current != buffer_end) current++;
 
-	current++;
-	col += 1;
+	if (length > max_token_length) {
+		t.type = unexpected;
+		t.length = 1;
+		t.data--;
+		return t;
+	}
 
+	t.length = length;
 	return t;
 }
 
@@ -339,10 +510,12 @@ std::ostream &operator <<(std::ostream &o, const token& t) {
 	switch (t.type) {
 	case v_real:
 		return o << t.real;
-	case v_name: case unexpected:
-		return o.write(t.string.data, t.string.length);
+	case v_name:
+		return o.write(t.name->data, t.name->length);
+	case unexpected:
+		return o.write(t.data, t.length);
 	case v_string:
-		o << '"'; o.write(t.string.data, t.string.length); return o << '"';
+		o << '"'; o.write(t.data, t.length); return o << '"';
 
 #	define KEYWORD(X) case kw_ ## X: return o << #X;
 #	define OPERATOR(X, Y) case X: return o << Y;
@@ -13,8 +13,6 @@ bool isassignment(token_type t) {
 	}
 }
 
-symbol_table symbols;
-
 parser::parser(token_stream& l, arena &allocator, error_stream& e) :
 	lexer(l), current(lexer.gettoken()), allocator(allocator), errors(e) {}
 
@@ -24,7 +22,7 @@ node *parser::getprogram() {
 		stmt = getstatement();
 	}
 	else {
-		std::vector<statement*> stmts;
+		list_builder<statement*> stmts(allocator);
 		while (current.type != eof) {
 			stmts.push_back(getstatement());
 		}
@@ -36,6 +34,13 @@ node *parser::getprogram() {
 	return stmt;
 }
 
+// parses the whole input as a single expression, like a D&D argument
+expression *parser::getargument() {
+	expression *expr = getexpression();
+	advance(eof);
+	return expr;
+}
+
 expression *parser::getexpression(int prec) {
 	token t = advance();
 
@@ -44,7 +49,7 @@ expression *parser::getexpression(int prec) {
 		// skip to the next token that could start an expression
 		do advance(); while (!symbols[current.type].nud);
 
-		return error_expr(unexpected_token_error(t, "expression"));
+		return error_expr(unexpected_token(t, "expression"));
 	}
 	expression *left = (this->*n)(t);
 
@@ -72,7 +77,7 @@ expression *parser::getexpression(int prec) {
 			// skip to (I hope) the start of the next statement
 			while (!symbols[current.type].std) advance();
 
-			return error_expr(unexpected_token_error(t, "operator"));
+			return error_expr(unexpected_token(t, "operator"));
 		}
 		left = (this->*l)(t, left);
 	}
@@ -109,7 +114,7 @@ expression *parser::dot_led(token t, expression *left) {
 }
 
 expression *parser::square_led(token, expression *left) {
-	std::vector<expression*> indices;
+	list_builder<expression*> indices(allocator);
 	while (current.type != r_square && current.type != eof) {
 		indices.push_back(getexpression());
 
@@ -126,7 +131,7 @@ expression *parser::square_led(token, expression *left) {
 		token e = current;
 		while (!symbols[current.type].std) advance();
 
-		return error_expr(unexpected_token_error(e, "[ or ,"));
+		return error_expr(unexpected_token(e, "[ or ,"));
 	}
 
 	advance();
@@ -135,7 +140,7 @@ expression *parser::square_led(token, expression *left) {
 }
 
 expression *parser::paren_led(token, expression *left) {
-	std::vector<expression*> args;
+	list_builder<expression*> args(allocator);
 	while (current.type != r_paren && current.type != eof) {
 		args.push_back(getexpression(0));
 
@@ -159,7 +164,7 @@ statement *parser::getstatement() {
 		token e = current;
 		while (!symbols[current.type].std) advance();
 
-		return error_stmt(unexpected_token_error(e, "statement"));
+		return error_stmt(unexpected_token(e, "statement"));
 	}
 	statement *stmt = (this->*s)();
 
@@ -180,7 +185,7 @@ statement *parser::expr_std() {
 	if (!isassignment(current.type)) {
 		token e = current;
 		while (!symbols[current.type].std) advance();
-		return error_stmt(unexpected_token_error(e, "assignment operator"));
+		return error_stmt(unexpected_token(e, "assignment operator"));
 	}
 
 	token_type op = advance().type;
@@ -193,7 +198,7 @@ statement *parser::expr_std() {
 statement *parser::var_std() {
 	token t = advance();
 
-	std::vector<value*> names;
+	list_builder<value*> names(allocator);
 	while (current.type != semicolon && current.type != eof) {
 		token n = advance(v_name);
 		if (n.type != v_name) return new (allocator) declaration(t, names);
@@ -213,7 +218,7 @@ statement *parser::var_std() {
 statement *parser::brace_std() {
 	advance();
 
-	std::vector<statement*> stmts;
+	list_builder<statement*> stmts(allocator);
 	while (current.type != r_brace && current.type != eof) {
 		stmts.push_back(getstatement());
 	}
@@ -297,7 +302,7 @@ statement *parser::switch_std() {
 	expression *expr = getexpression();
 
 	if (current.type != l_brace) {
-		return error_stmt(unexpected_token_error(current, l_brace));
+		return error_stmt(unexpected_token(current, l_brace));
 	}
 	block *stmts = static_cast<block*>(brace_std());
 
@@ -352,7 +357,7 @@ token parser::advance(token_type t) {
 	if (n.type != t) {
 		// skip to (I hope) the beginning of the next statement
 		while (!symbols[current.type].std) advance();
-		errors.error(unexpected_token_error(n, t));
+		errors.error(unexpected_token(n, t));
 	}
 	return n;
 }
@@ -367,87 +372,70 @@ expression_error *parser::error_expr(const unexpected_token_error &e) {
 	return new (allocator) expression_error;
 }
 
-void symbol_table::prefix(token_type t, nud_parser nud) {
-	(*this)[t].nud = nud;
+constexpr symbol symbol_table::prefix(nud_parser nud) {
+	return { 0, 0, nud, 0 };
 }
 
-void symbol_table::infix(token_type t, int prec, led_parser led) {
-	(*this)[t].precedence = prec;
-	(*this)[t].led = led;
+constexpr symbol symbol_table::infix(int prec, led_parser led) {
+	return { prec, 0, 0, led };
 }
 
-symbol_table::symbol_table() {
-	symbols[v_real].nud = symbols[v_string].nud =
-	symbols[kw_self].nud = symbols[kw_other].nud =
-	symbols[kw_all].nud = symbols[kw_noone].nud =
-	symbols[kw_global].nud = symbols[kw_local].nud =
-	symbols[kw_true].nud = symbols[kw_false].nud =
-	symbols[v_name].nud = &parser::id_nud;
-
-	infix(dot, 90, &parser::dot_led);
+constexpr symbol symbol_table::get(token_type t) {
+	switch (t) {
+	case v_name:
+	case kw_self: case kw_other: case kw_all: case kw_noone:
+	case kw_global: case kw_local:
+		return { 0, &parser::expr_std, &parser::id_nud, 0 };
 
-	prefix(l_paren, &parser::paren_nud);
+	case v_real: case v_string: case kw_true: case kw_false:
+		return { 0, 0, &parser::id_nud, 0 };
 
-	infix(l_paren, 80, &parser::paren_led);
-	infix(l_square, 80, &parser::square_led);
+	case dot: return infix(90, &parser::dot_led);
 
-	prefix(exclaim);
-	prefix(tilde);
-	prefix(minus);
-	prefix(plus);
+	case l_paren:
+		return { 80, &parser::expr_std, &parser::paren_nud, &parser::paren_led };
+	case l_square: return infix(80, &parser::square_led);
 
-	infix(times, 60);
-	infix(divide, 60);
-	infix(kw_div, 60);
-	infix(kw_mod, 60);
+	case exclaim: case tilde: return prefix();
+	case plus: case minus:
+		return { 50, 0, &parser::prefix_nud, &parser::infix_led };
 
-	infix(plus, 50);
-	infix(minus, 50);
+	case times: case divide: case kw_div: case kw_mod: return infix(60);
 
-	infix(shift_left, 40);
-	infix(shift_right, 40);
+	case shift_left: case shift_right: return infix(40);
 
-	infix(bit_and, 30);
-	infix(bit_or, 30);
-	infix(bit_xor, 30);
+	case bit_and: case bit_or: case bit_xor: return infix(30);
 
-	infix(less, 20);
-	infix(less_equals, 20);
-	infix(is_equals, 20);
-	infix(equals, 20);
-	infix(not_equals, 20);
-	infix(greater, 20);
-	infix(greater_equals, 20);
+	case less: case less_equals: case is_equals: case equals:
+	case not_equals: case greater: case greater_equals:
+		return infix(20);
 
-	infix(ampamp, 10);
-	infix(pipepipe, 10);
-	infix(caretcaret, 10);
+	case ampamp: case pipepipe: case caretcaret: return infix(10);
 
-	symbols[kw_var].std = symbols[kw_globalvar].std =
-	&parser::var_std;
+	case kw_var: case kw_globalvar: return { 0, &parser::var_std, 0, 0 };
 
-	symbols[v_name].std = symbols[l_paren].std =
-	symbols[kw_self].std = symbols[kw_other].std =
-	symbols[kw_all].std = symbols[kw_noone].std =
-	symbols[kw_global].std = symbols[kw_local].std =
-	&parser::expr_std;
+	case l_brace: return { 0, &parser::brace_std, 0, 0 };
 
-	symbols[l_brace].std = &parser::brace_std;
+	case kw_if: return { 0, &parser::if_std, 0, 0 };
+	case kw_while: return { 0, &parser::while_std, 0, 0 };
+	case kw_do: return { 0, &parser::do_std, 0, 0 };
+	case kw_repeat: return { 0, &parser::repeat_std, 0, 0 };
+	case kw_for: return { 0, &parser::for_std, 0, 0 };
+	case kw_switch: return { 0, &parser::switch_std, 0, 0 };
+	case kw_with: return { 0, &parser::with_std, 0, 0 };
 
-	symbols[kw_if].std = &parser::if_std;
-	symbols[kw_while].std = &parser::while_std;
-	symbols[kw_do].std = &parser::do_std;
-	symbols[kw_repeat].std = &parser::repeat_std;
-	symbols[kw_for].std = &parser::for_std;
-	symbols[kw_switch].std = &parser::switch_std;
-	symbols[kw_with].std = &parser::with_std;
+	case kw_break: case kw_continue: case kw_exit:
+		return { 0, &parser::jump_std, 0, 0 };
+	case kw_return: return { 0, &parser::return_std, 0, 0 };
+	case kw_case: case kw_default: return { 0, &parser::case_std, 0, 0 };
 
-	symbols[kw_break].std = symbols[kw_continue].std =
-	symbols[kw_exit].std = &parser::jump_std;
-	symbols[kw_return].std = &parser::return_std;
-	symbols[kw_case].std = symbols[kw_default].std =
-	&parser::case_std;
+	case eof: return { 0, &parser::null_std, &parser::null_nud, 0 };
 
-	symbols[eof].std = &parser::null_std;
-	symbols[eof].nud = &parser::null_nud;
+	default: return { 0, 0, 0, 0 };
+	}
 }
+
+constexpr symbol_table symbols = { {
+#	define TOK(X) symbol_table::get(X),
+#	include <dejavu/compiler/tokens.tbl>
+} };
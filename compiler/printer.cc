@@ -1,15 +1,16 @@
 #include <dejavu/compiler/printer.h>
 #include <dejavu/compiler/parser.h>
+#include <dejavu/compiler/identifier.h>
 #include <cstdio>
 
 void print_token(const token& t) {
 	switch (t.type) {
 	case unexpected:
-		printf("%.*s", (int)t.string.length, t.string.data);
+		printf("%.*s", (int)t.length, t.data);
 		break;
 
 	case v_name:
-		printf("%.*s", (int)t.string.length, t.string.data);
+		printf("%.*s", (int)t.name->length, t.name->data);
 		break;
 
 	case v_real:
@@ -17,7 +18,7 @@ void print_token(const token& t) {
 		break;
 
 	case v_string:
-		printf("\"%.*s\"", (int)t.string.length, t.string.data);
+		printf("\"%.*s\"", (int)t.length, t.data);
 		break;
 
 #	define KEYWORD(X) case kw_ ## X: printf(#X); break;
@@ -41,7 +42,7 @@ void node_printer::visit_value(value *v) {
 }
 
 void node_printer::visit_unary(unary *u) {
-	print_token(token(u->op, 0, 0));
+	print_token(token(u->op, 0));
 
 	int p = precedence;
 	precedence = 70;
@@ -60,7 +61,7 @@ void node_printer::visit_binary(binary *b) {
 
 	visit(b->left);
 	if (b->op != dot) printf(" ");
-	print_token(token(b->op, 0, 0));
+	print_token(token(b->op, 0));
 	if (b->op != dot) printf(" ");
 	visit(b->right);
 
@@ -97,7 +98,7 @@ void node_printer::visit_statement_error(statement_error*) {
 
 void node_printer::visit_assignment(assignment *a) {
 	visit(a->lvalue); printf(" ");
-	print_token(token(a->op, 0, 0)); printf(" ");
+	print_token(token(a->op, 0)); printf(" ");
 	visit(a->rvalue); printf(";");
 }
 
@@ -114,7 +115,7 @@ void node_printer::visit_declaration(declaration *d) {
 void node_printer::visit_block(block *b) {
 	printf("{\n"); scope++;
 	for (
-		std::vector<statement*>::iterator it = b->stmts.begin();
+		statement **it = b->stmts.begin();
 		it != b->stmts.end(); ++it
 	) {
 		if ((*it)->type == casestatement_node) scope--;
@@ -176,7 +177,7 @@ void node_printer::visit_withstatement(withstatement *w) {
 }
 
 void node_printer::visit_jump(jump *j) {
-	print_token(token(j->type, 0, 0)); printf(";");
+	print_token(token(j->type, 0)); printf(";");
 }
 
 void node_printer::visit_returnstatement(returnstatement *r) {
@@ -0,0 +1,354 @@
+#include <dejavu/compiler/refcount.h>
+#include <llvm/Pass.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/ADT/SmallVector.h>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+// a pointer as the object it points into and the constant indices to it,
+// starting with the index of the object itself, as in a gep
+// codegen bitcasts variants to their tag and payload pair and back, so casts
+// are looked through, and a location covers every path it's a prefix of
+struct location {
+	Value *base;
+	SmallVector<uint64_t, 4> path;
+
+	// false when some index isn't constant
+	bool exact;
+
+	bool covers(const location &o) const {
+		if (base != o.base || !exact || path.size() > o.path.size()) return false;
+		return std::equal(path.begin(), path.end(), o.path.begin());
+	}
+};
+
+location locate(Value *p) {
+	std::vector<GEPOperator*> geps;
+	for (;;) {
+		if (Operator::getOpcode(p) == Instruction::BitCast) {
+			p = cast<Operator>(p)->getOperand(0);
+		}
+		else if (GEPOperator *gep = dyn_cast<GEPOperator>(p)) {
+			geps.push_back(gep);
+			p = gep->getPointerOperand();
+		}
+		else break;
+	}
+
+	location l;
+	l.base = p;
+	l.path.push_back(0);
+	l.exact = true;
+	for (auto it = geps.rbegin(); it != geps.rend(); ++it) {
+		GEPOperator *gep = *it;
+		for (auto idx = gep->idx_begin(); idx != gep->idx_end(); ++idx) {
+			ConstantInt *index = dyn_cast<ConstantInt>(*idx);
+			if (!index) {
+				l.exact = false;
+				return l;
+			}
+
+			// the first index steps over whole objects, the rest go inside them
+			if (idx == gep->idx_begin()) l.path.back() += index->getZExtValue();
+			else l.path.push_back(index->getZExtValue());
+		}
+	}
+
+	return l;
+}
+
+// a field of an aggregate built by insertvalue or a constant, if it's known
+Value *element(Value *v, ArrayRef<uint64_t> path) {
+	for (uint64_t index : path) {
+		if (!v) return 0;
+
+		while (InsertValueInst *insert = dyn_cast<InsertValueInst>(v)) {
+			ArrayRef<unsigned> indices = insert->getIndices();
+			if (indices.size() == 1 && indices[0] == index) break;
+			v = insert->getAggregateOperand();
+		}
+
+		if (InsertValueInst *insert = dyn_cast<InsertValueInst>(v))
+			v = insert->getInsertedValueOperand();
+		else if (Constant *c = dyn_cast<Constant>(v))
+			v = c->getAggregateElement(index);
+		else
+			return 0;
+	}
+
+	return v;
+}
+
+bool is_call_to(const Instruction *inst, StringRef name) {
+	const CallInst *call = dyn_cast<CallInst>(inst);
+	const Function *f = call ? call->getCalledFunction() : 0;
+	return f && f->getName() == name;
+}
+
+// intrinsics that never touch a variant
+bool is_harmless(const Instruction *inst) {
+	const IntrinsicInst *intrinsic = dyn_cast<IntrinsicInst>(inst);
+	if (!intrinsic) return false;
+
+	switch (intrinsic->getIntrinsicID()) {
+	default: return false;
+	case Intrinsic::dbg_declare: case Intrinsic::dbg_value:
+	case Intrinsic::lifetime_start: case Intrinsic::lifetime_end:
+		return true;
+	}
+}
+
+class refcount_elimination : public FunctionPass {
+public:
+	static char ID;
+	refcount_elimination() : FunctionPass(ID) {}
+
+	bool runOnFunction(Function &f) override;
+	void getAnalysisUsage(AnalysisUsage &au) const override {
+		au.setPreservesCFG();
+	}
+
+private:
+	bool is_noop(CallInst *call);
+	CallInst *find_retain(CallInst *release);
+
+	Value *stored_value(Instruction *from, const location &q);
+	bool may_write(Instruction *inst, const location &q);
+	bool may_alias(const location &a, const location &b);
+	bool is_local(Value *base);
+
+	// allocas whose address is only ever passed to calls, never stored, so
+	// nothing else can point into them. the runtime never keeps a pointer
+	// it's passed, only values it's passed
+	std::unordered_map<Value*, bool> locals;
+};
+
+char refcount_elimination::ID = 0;
+
+bool refcount_elimination::runOnFunction(Function &f) {
+	locals.clear();
+
+	std::vector<CallInst*> calls;
+	for (BasicBlock &b : f) {
+		for (Instruction &inst : b) {
+			if (
+				is_call_to(&inst, "retain") || is_call_to(&inst, "release") ||
+				is_call_to(&inst, "retain_var")
+			)
+				calls.push_back(cast<CallInst>(&inst));
+		}
+	}
+
+	bool changed = false;
+	std::vector<CallInst*> releases;
+	for (CallInst *call : calls) {
+		if (is_noop(call)) {
+			call->eraseFromParent();
+			changed = true;
+		}
+		else if (is_call_to(call, "release")) {
+			releases.push_back(call);
+		}
+	}
+
+	for (CallInst *release : releases) {
+		CallInst *retain = find_retain(release);
+		if (!retain) continue;
+
+		retain->eraseFromParent();
+		release->eraseFromParent();
+		changed = true;
+	}
+
+	return changed;
+}
+
+// the runtime only counts strings, and only iterates over a var's elements
+bool refcount_elimination::is_noop(CallInst *call) {
+	location l = locate(call->getArgOperand(0));
+	l.path.push_back(0);
+
+	if (is_call_to(call, "retain_var")) {
+		ConstantInt *x = dyn_cast_or_null<ConstantInt>(stored_value(call, l));
+		l.path.back() = 1;
+		ConstantInt *y = dyn_cast_or_null<ConstantInt>(stored_value(call, l));
+		return (x && x->isZero()) || (y && y->isZero());
+	}
+
+	ConstantInt *tag = dyn_cast_or_null<ConstantInt>(stored_value(call, l));
+	return tag && !tag->isOne();
+}
+
+// a retain of the same variant, with nothing in between that could release
+// anything. the variant may have been copied in the meantime
+// the walk only goes back into a block that always falls through to this one,
+// so no other path from the retain can have a release it was paired with
+CallInst *refcount_elimination::find_retain(CallInst *release) {
+	location q = locate(release->getArgOperand(0));
+	Value *contents = stored_value(release, q);
+	bool same_location = true;
+
+	std::unordered_set<BasicBlock*> visited;
+	BasicBlock *b = release->getParent();
+	BasicBlock::iterator it(*release);
+	for (;;) {
+		if (it == b->begin()) {
+			visited.insert(b);
+			b = b->getSinglePredecessor();
+			if (!b || visited.count(b)) return 0;
+			if (b->getTerminator()->getNumSuccessors() != 1) return 0;
+			it = b->end();
+			continue;
+		}
+
+		Instruction *inst = &*--it;
+		if (is_call_to(inst, "retain")) {
+			CallInst *retain = cast<CallInst>(inst);
+			location l = locate(retain->getArgOperand(0));
+			if (same_location && l.exact && q.exact && l.covers(q) && q.covers(l))
+				return retain;
+			if (contents && stored_value(retain, l) == contents)
+				return retain;
+			continue;
+		}
+
+		if (isa<CallInst>(inst) && !isa<MemCpyInst>(inst) && !is_harmless(inst))
+			return 0;
+		if (may_write(inst, q)) same_location = false;
+	}
+}
+
+// the value last stored to a location before an instruction, if it's known
+// this follows copies, and looks into blocks with a single predecessor
+Value *refcount_elimination::stored_value(Instruction *from, const location &q) {
+	if (!q.exact) return 0;
+
+	GlobalVariable *global = dyn_cast<GlobalVariable>(q.base);
+	if (global && global->isConstant() && global->hasInitializer()) {
+		if (q.path[0] != 0) return 0;
+		return element(global->getInitializer(), makeArrayRef(q.path).slice(1));
+	}
+
+	std::unordered_set<BasicBlock*> visited;
+	BasicBlock *b = from->getParent();
+	BasicBlock::iterator it(*from);
+	for (;;) {
+		if (it == b->begin()) {
+			visited.insert(b);
+			b = b->getSinglePredecessor();
+			if (!b || visited.count(b)) return 0;
+			it = b->end();
+			continue;
+		}
+
+		Instruction *inst = &*--it;
+		if (inst == q.base) return 0;
+
+		if (StoreInst *store = dyn_cast<StoreInst>(inst)) {
+			location w = locate(store->getPointerOperand());
+			if (w.covers(q)) {
+				return element(
+					store->getValueOperand(),
+					makeArrayRef(q.path).slice(w.path.size())
+				);
+			}
+			if (may_alias(w, q)) return 0;
+			continue;
+		}
+
+		if (MemCpyInst *copy = dyn_cast<MemCpyInst>(inst)) {
+			location w = locate(copy->getRawDest());
+			if (w.covers(q)) {
+				location source = locate(copy->getRawSource());
+				source.path.append(q.path.begin() + w.path.size(), q.path.end());
+				return stored_value(copy, source);
+			}
+			if (may_alias(w, q)) return 0;
+			continue;
+		}
+
+		if (may_write(inst, q)) return 0;
+	}
+}
+
+// retains and releases change a string's count, never the variant itself
+bool refcount_elimination::may_write(Instruction *inst, const location &q) {
+	if (!inst->mayWriteToMemory()) return false;
+	if (is_harmless(inst)) return false;
+	if (is_call_to(inst, "retain") || is_call_to(inst, "release")) return false;
+
+	if (StoreInst *store = dyn_cast<StoreInst>(inst))
+		return may_alias(locate(store->getPointerOperand()), q);
+	if (MemCpyInst *copy = dyn_cast<MemCpyInst>(inst))
+		return may_alias(locate(copy->getRawDest()), q);
+
+	// calls can only reach a local through their arguments
+	CallInst *call = dyn_cast<CallInst>(inst);
+	if (call && is_local(q.base)) {
+		for (Value *operand : call->operands()) {
+			if (locate(operand).base == q.base) return true;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+bool refcount_elimination::may_alias(const location &a, const location &b) {
+	if (a.base == b.base) {
+		if (!a.exact || !b.exact) return true;
+
+		size_t n = std::min(a.path.size(), b.path.size());
+		return std::equal(a.path.begin(), a.path.begin() + n, b.path.begin());
+	}
+
+	bool a_object = isa<AllocaInst>(a.base) || isa<GlobalVariable>(a.base);
+	bool b_object = isa<AllocaInst>(b.base) || isa<GlobalVariable>(b.base);
+	if (a_object && b_object) return false;
+
+	return !is_local(a.base) && !is_local(b.base);
+}
+
+bool refcount_elimination::is_local(Value *base) {
+	if (!isa<AllocaInst>(base)) return false;
+
+	auto it = locals.find(base);
+	if (it != locals.end()) return it->second;
+
+	bool local = true;
+	std::vector<Value*> pointers(1, base);
+	while (local && !pointers.empty()) {
+		Value *p = pointers.back();
+		pointers.pop_back();
+
+		for (User *user : p->users()) {
+			if (isa<BitCastInst>(user) || isa<GetElementPtrInst>(user)) {
+				pointers.push_back(user);
+			}
+			else if (StoreInst *store = dyn_cast<StoreInst>(user)) {
+				if (store->getValueOperand() == p) local = false;
+			}
+			else if (!isa<LoadInst>(user) && !isa<CallInst>(user)) {
+				local = false;
+			}
+		}
+	}
+
+	return locals[base] = local;
+}
+
+}
+
+FunctionPass *create_refcount_elimination() {
+	return new refcount_elimination();
+}
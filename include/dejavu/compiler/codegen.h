@@ -3,22 +3,49 @@
 
 #include <dejavu/compiler/node_visitor.h>
 #include <dejavu/compiler/error_stream.h>
+#include <dejavu/compiler/identifier.h>
+#include <dejavu/compiler/inference.h>
+#include <dejavu/compiler/ir.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/ADT/StringMap.h>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <vector>
+
+// the instance variables self is known to have, in slot order
+typedef std::vector<std::string> instance_layout;
 
 class node_codegen : public node_visitor<node_codegen, llvm::Value*> {
 public:
 	node_codegen(const llvm::Module &runtime, error_stream &e);
 	llvm::Function *add_function(
-		node*, const char *name, size_t nargs, bool var
+		node*, const char *name, size_t nargs, bool var,
+		const instance_layout *self = 0
 	);
+	void add_layout(const std::string &name, const instance_layout &layout);
 	llvm::Module &get_module() { return module; }
 
+	// with the ir, function bodies it covers go through gml passes first
+	void set_ir(bool ir) { use_ir = ir; }
+	identifier_pool &get_names() { return names; }
+
 	void register_script(const std::string &name);
+	bool is_script(const std::string &name);
+
+	// calls to scripts bind to a fixed arity clone, which the linker must
+	// compile for every arity a script is called with
+	static const size_t max_arguments = 16;
+	static std::string clone_name(llvm::StringRef script, size_t nargs);
+
+	// the global layout, and every name declared globalvar anywhere in the game
+	// without these, any unqualified name might turn out to be a globalvar
+	void register_globals(
+		const instance_layout &globals, const std::vector<std::string> &globalvars
+	);
+	int global_slot(const std::string &name);
+	bool is_globalvar(const std::string &name);
 
 // really should be private
 	llvm::Value *visit_value(value *v);
@@ -46,14 +73,54 @@ public:
 
 private:
 	llvm::Function *get_function(llvm::StringRef name, int args, bool var);
+	llvm::Function *get_function(const identifier *name, int args, bool var);
 	llvm::Function *get_operator(llvm::StringRef name, int args);
+	llvm::Value *call_function(
+		const identifier *name, llvm::ArrayRef<llvm::Value*> args
+	);
+
+	bool build_ir(node *body);
+	void lower(ir_function &f);
+	llvm::Value *spill(llvm::Value *val);
 
 	llvm::Value *get_real(double val);
 	llvm::Value *get_real(llvm::Value *val);
 	llvm::Value *get_string(llvm::StringRef val);
+	llvm::Value *intern_string(llvm::StringRef val);
+	llvm::GlobalVariable *get_literal_slot(llvm::StringRef val);
+	llvm::Function *get_string_init();
 
-	llvm::Value *to_bool(node *val);
+	llvm::Value *real_value(expression *e);
+	llvm::Value *real_unary(token_type op, llvm::Value *a);
+	llvm::Value *real_binary(token_type op, llvm::Value *l, llvm::Value *r);
+	llvm::Value *operator_value(
+		token_type op, expression *left, expression *right, bool to_double
+	);
+	llvm::Value *operator_call(
+		token_type op, llvm::Value *l, llvm::Value *r, bool strings, bool to_double
+	);
+	llvm::Value *as_real(expression *e);
+	llvm::Value *variant_real(llvm::Value *variant);
+
+	llvm::Value *is_real(llvm::Value *variant);
+	llvm::Value *is_string(llvm::Value *variant);
+	llvm::Value *load_tag(llvm::Value *variant);
+	llvm::Value *load_variant(llvm::Value *variant);
+	void store_variant(llvm::Value *variant, llvm::Value *val);
+	llvm::Value *load_real(llvm::Value *variant);
+	void store_real(llvm::Value *variant, llvm::Value *val);
+
+	void branch(
+		expression *cond, llvm::BasicBlock *t, llvm::BasicBlock *f,
+		bool nonzero = false
+	);
+	llvm::Value *logical_value(binary *b);
 	llvm::Value *is_equal(llvm::Value *a, llvm::Value *b);
+	bool lower_switch(
+		llvm::Value *switch_expr, const std::vector<casestatement*> &labels,
+		llvm::BasicBlock *switch_default,
+		std::unordered_map<casestatement*, llvm::BasicBlock*> &cases
+	);
 
 	llvm::Value *make_local(llvm::StringRef name, llvm::Value *value);
 	llvm::Value *make_local(
@@ -64,10 +131,16 @@ private:
 	llvm::AllocaInst *alloc(llvm::Type*, const llvm::Twine&);
 	llvm::AllocaInst *alloc(llvm::Type*, llvm::Value*, const llvm::Twine&);
 
-	llvm::Value *do_lookup(llvm::Value *left, llvm::Value *right, bool lvalue);
-	llvm::Value *do_lookup_default(
-		llvm::Value *right, bool lvalue
+	llvm::Value *get_slot(llvm::Value *scope, unsigned slot);
+	llvm::Value *get_self_slot(const identifier *name);
+	llvm::Value *get_global_slot(expression *left, const identifier *name);
+	llvm::Value *get_argument(const identifier *name);
+	llvm::Value *do_access(
+		llvm::Value *var, llvm::Value *x, llvm::Value *y, bool lvalue
 	);
+	llvm::Value *do_lookup(llvm::Value *left, llvm::Value *right, bool lvalue);
+	llvm::Value *get_lookup_cache();
+	llvm::Value *do_lookup_default(const identifier *name, bool lvalue);
 
 	const llvm::Module &runtime;
 	const llvm::DataLayout dl;
@@ -75,20 +148,49 @@ private:
 	llvm::IRBuilder<> builder;
 	llvm::Module module;
 
+	// constant pool: reals by value, and strings by the slot they're interned into
+	std::unordered_map<llvm::Constant*, llvm::GlobalVariable*> real_constants;
 	llvm::StringMap<llvm::GlobalVariable*> string_literals;
+	llvm::Function *string_init = 0;
+
+	// names from the lexer are interned here, so symbols are keyed by address
+	identifier_pool names;
+	const identifier *argument_name;
+	const identifier *argument_count_name;
+	const identifier *argument_names[max_arguments];
+
+	type_inference types;
+
+	bool use_ir = false;
+	ir_pass_manager ir_passes;
 
 	// todo: resolve namespace issues by mapping to llvm::Function*s
-	std::unordered_set<std::string> scripts;
+	std::unordered_set<const identifier*> scripts;
+	std::unordered_map<const identifier*, llvm::Function*> functions;
+
+	std::unordered_map<const identifier*, unsigned> global_slots;
+	std::unordered_set<const identifier*> globalvars;
+	bool globals_registered = false;
+	llvm::GlobalVariable *global_scope = 0;
 
 	// runtime types
 	llvm::PointerType *scope_type;
+	llvm::StructType *layout_type;
+	llvm::StructType *cache_type;
 	llvm::StructType *var_type;
 	llvm::StructType *variant_type;
 	llvm::StructType *ret_type;
 	llvm::Type *real_type;
-	llvm::Type *string_type;
+	llvm::PointerType *string_type;
 	int union_diff;
 
+	// branch weights favoring the inline path for real operands
+	llvm::MDNode *likely_real;
+
+	// tbaa access tags, so variant loads survive stores to vars and scopes
+	llvm::MDNode *variant_tbaa, *tag_tbaa, *payload_tbaa;
+	llvm::MDNode *var_tbaa, *scope_tbaa;
+
 	// runtime functions
 	llvm::Function *to_real;
 	llvm::Function *to_string;
@@ -109,10 +211,14 @@ private:
 	llvm::Function *with_inc;
 
 	// scope handling
-	std::unordered_map<std::string, llvm::Value*> scope;
+	std::unordered_map<const identifier*, llvm::Value*> scope;
+	std::unordered_map<const identifier*, llvm::Value*> scalars;
+	std::unordered_map<const identifier*, llvm::Value*> reals;
 	llvm::Instruction *alloca_point = 0;
 	llvm::Value *return_value = 0;
 	llvm::Value *self_scope = 0;
+	llvm::Value *function_self = 0;
+	std::unordered_map<const identifier*, unsigned> self_slots;
 	llvm::Value *other_scope = 0;
 
 	llvm::BasicBlock *current_loop = 0;
@@ -121,6 +227,7 @@ private:
 	llvm::Function::iterator current_cond = 0;
 	llvm::BasicBlock *current_default = 0;
 	llvm::Value *current_switch = 0;
+	std::unordered_map<casestatement*, llvm::BasicBlock*> *current_cases = 0;
 
 	bool lvalue = false;
 
@@ -128,7 +235,29 @@ private:
 };
 
 inline void node_codegen::register_script(const std::string &name) {
-	scripts.insert(name);
+	scripts.insert(names.intern(name.data(), name.size()));
+}
+
+inline bool node_codegen::is_script(const std::string &name) {
+	const identifier *id = names.find(name.data(), name.size());
+	return id && scripts.find(id) != scripts.end();
+}
+
+inline std::string node_codegen::clone_name(
+	llvm::StringRef script, size_t nargs
+) {
+	return script.str() + "." + std::to_string(nargs);
+}
+
+inline int node_codegen::global_slot(const std::string &name) {
+	const identifier *id = names.find(name.data(), name.size());
+	auto slot = id ? global_slots.find(id) : global_slots.end();
+	return slot != global_slots.end() ? slot->second : -1;
+}
+
+inline bool node_codegen::is_globalvar(const std::string &name) {
+	const identifier *id = names.find(name.data(), name.size());
+	return id && globalvars.find(id) != globalvars.end();
 }
 
 inline llvm::AllocaInst *node_codegen::alloc(
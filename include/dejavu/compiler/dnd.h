@@ -0,0 +1,48 @@
+#ifndef DND_H
+#define DND_H
+
+#include <dejavu/compiler/node.h>
+#include <dejavu/compiler/error_stream.h>
+#include <dejavu/system/arena.h>
+#include <string>
+
+class identifier_pool;
+struct event;
+struct action;
+struct argument;
+
+// builds the AST for an event's D&D actions without going through GML text
+// code actions become calls to functions named <name>_<index>
+class action_parser {
+public:
+	action_parser(
+		const event &evt, const std::string &name,
+		arena &allocator, identifier_pool &names, error_stream &e
+	);
+	node *getprogram();
+
+private:
+	statement *getstatement();
+	statement *getbody(const char *after);
+
+	expression *getcall(const action &act);
+	expression *getargument(const argument &arg);
+	expression *getexpression(const char *code);
+
+	value *getname(const std::string &name);
+	value *getreal(double real);
+	value *getstring(const char *data, size_t length);
+
+	const action *peek();
+	statement_error *error(const std::string &message);
+
+	const event &evt;
+	const std::string &name;
+	unsigned int current;
+
+	arena &allocator;
+	identifier_pool &names;
+	error_stream &errors;
+};
+
+#endif
@@ -4,13 +4,16 @@
 #include <dejavu/compiler/lexer.h>
 
 struct unexpected_token_error {
-	unexpected_token_error(token unexpected, const char *expected) :
-		unexpected(unexpected), expected(expected) {}
+	unexpected_token_error(
+		token unexpected, source_location location, const char *expected
+	) : unexpected(unexpected), location(location), expected(expected) {}
 
-	unexpected_token_error(token unexpected, token_type exp) :
-		unexpected(unexpected), expected_token(exp) {}
+	unexpected_token_error(
+		token unexpected, source_location location, token_type exp
+	) : unexpected(unexpected), location(location), expected_token(exp) {}
 
 	token unexpected;
+	source_location location;
 	const char *expected = 0;
 	token_type expected_token = ::unexpected;
 };
@@ -21,11 +24,11 @@ struct redefinition_error {
 };
 
 struct unsupported_error {
-	unsupported_error(std::string name, token position) :
+	unsupported_error(std::string name, source_location position) :
 		name(name), position(position) {}
 
 	std::string name;
-	token position;
+	source_location position;
 };
 
 struct error_stream {
@@ -0,0 +1,63 @@
+#ifndef FOLDER_H
+#define FOLDER_H
+
+#include <dejavu/compiler/node_visitor.h>
+#include <dejavu/system/arena.h>
+
+class identifier_pool;
+struct identifier;
+
+// evaluates constant expressions and conditions ahead of codegen
+// results match what the runtime would compute, and anything the runtime
+// would report as an error is left alone so it still happens at runtime
+class node_folder : public node_visitor<node_folder, node*> {
+public:
+	node_folder(arena &allocator, identifier_pool &names);
+
+	node *fold(node *n) { return n ? visit(n) : n; }
+
+	node *visit_expression_error(expression_error *e) { return e; }
+
+	node *visit_value(value *v) { return v; }
+	node *visit_unary(unary *u);
+	node *visit_binary(binary *b);
+	node *visit_subscript(subscript *s);
+	node *visit_call(call *c);
+
+	node *visit_assignment(assignment *a);
+	node *visit_invocation(invocation *i);
+	node *visit_declaration(declaration *d) { return d; }
+	node *visit_block(block *b);
+
+	node *visit_ifstatement(ifstatement *i);
+	node *visit_whilestatement(whilestatement *w);
+	node *visit_dostatement(dostatement *d);
+	node *visit_repeatstatement(repeatstatement *r);
+	node *visit_forstatement(forstatement *f);
+	node *visit_switchstatement(switchstatement *s);
+	node *visit_withstatement(withstatement *w);
+
+	node *visit_jump(jump *j) { return j; }
+	node *visit_returnstatement(returnstatement *r);
+	node *visit_casestatement(casestatement *c);
+
+	node *visit_statement_error(statement_error *e) { return e; }
+
+private:
+	expression *fold(expression *e) { return static_cast<expression*>(fold((node*)e)); }
+	statement *fold(statement *s) { return static_cast<statement*>(fold((node*)s)); }
+
+	bool constant(expression *e, token &t);
+	bool condition(expression *&cond, bool &result);
+
+	value *make_real(double real);
+	value *make_string(const char *data, size_t length);
+	block *make_empty();
+
+	bool droppable(statement *s);
+
+	arena &allocator;
+	const identifier *string_name;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef IDENTIFIER_H
+#define IDENTIFIER_H
+
+#include <dejavu/system/arena.h>
+#include <dejavu/system/table.h>
+#include <cstddef>
+
+// an interned name- each pool has exactly one identifier per distinct name,
+// so identifiers can be compared and hashed by address
+struct identifier {
+	size_t length;
+	const char *data;
+};
+
+// whether a name is argument followed by a number, like argument0
+bool is_numbered_argument(const identifier *name);
+
+class identifier_pool {
+	struct key {
+		const char *data;
+		size_t length;
+		size_t hash;
+	};
+
+	struct key_hash {
+		size_t operator()(const key &k) const { return k.hash; }
+	};
+
+	struct key_equal {
+		bool operator()(const key &a, const key &b) const;
+	};
+
+	typedef table<key, identifier*, key_hash, key_equal> identifier_table;
+
+public:
+	identifier_pool() {}
+	identifier_pool(const identifier_pool&) = delete;
+	identifier_pool &operator=(const identifier_pool&) = delete;
+
+	const identifier *intern(const char *data, size_t length);
+
+	// returns null for names that were never interned
+	const identifier *find(const char *data, size_t length);
+
+	size_t size() { return pool.size(); }
+
+private:
+	identifier_table pool;
+	arena allocator;
+};
+
+#endif
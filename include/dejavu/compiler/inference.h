@@ -0,0 +1,42 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#include <dejavu/compiler/node.h>
+#include <unordered_set>
+
+class identifier_pool;
+struct identifier;
+
+enum value_type { type_any, type_real, type_string };
+
+// finds the locals in a function that can skip the runtime's var arrays
+// a local is scalar if it's never subscripted and never read before it's
+// definitely assigned, so it can live in a plain variant. a scalar is also
+// real if every assignment to it produces a real, so it can be a native double
+class type_inference {
+public:
+	type_inference(identifier_pool &names);
+
+	void infer(node *body);
+
+	bool is_scalar(const identifier *name) const {
+		return scalars.find(name) != scalars.end();
+	}
+	bool is_real(const identifier *name) const {
+		return reals.find(name) != reals.end();
+	}
+
+	value_type type_of(expression *e) const;
+
+private:
+	// names that refer to a local, rather than an instance variable
+	std::unordered_set<const value*> locals;
+	std::unordered_set<const identifier*> scalars;
+	std::unordered_set<const identifier*> reals;
+
+	const identifier *string_name;
+	const identifier *argument_name;
+	const identifier *argument_count_name;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <dejavu/compiler/node_visitor.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <set>
+
+struct identifier;
+
+// finds the instance variables code uses through its own self: names that
+// aren't locals, aren't qualified with another instance, and aren't inside a
+// with. also records globalvar declarations, which take precedence over them,
+// and the globals code names with global.x, and how many arguments each
+// function is called with
+class instance_variables : public node_visitor<instance_variables> {
+public:
+	void collect(node *program);
+
+	// in order of first use
+	const std::vector<const identifier*> &get_names() const { return names; }
+	const std::unordered_set<const identifier*> &get_globalvars() const {
+		return globalvars;
+	}
+	const std::vector<const identifier*> &get_globals() const { return globals; }
+	const std::unordered_map<const identifier*, std::set<size_t>> &get_calls() const {
+		return calls;
+	}
+
+	void visit_value(value *v);
+	void visit_unary(unary *u);
+	void visit_binary(binary *b);
+	void visit_subscript(subscript *s);
+	void visit_call(call *c);
+
+	void visit_assignment(assignment *a);
+	void visit_invocation(invocation *i);
+	void visit_declaration(declaration *d);
+	void visit_block(block *b);
+
+	void visit_ifstatement(ifstatement *i);
+	void visit_whilestatement(whilestatement *w);
+	void visit_dostatement(dostatement *d);
+	void visit_repeatstatement(repeatstatement *r);
+	void visit_forstatement(forstatement *f);
+	void visit_switchstatement(switchstatement *s);
+	void visit_withstatement(withstatement *w);
+
+	void visit_returnstatement(returnstatement *r);
+	void visit_casestatement(casestatement *c);
+
+private:
+	void check(node *n) { if (n) visit(n); }
+
+	std::vector<const identifier*> names;
+	std::unordered_set<const identifier*> seen;
+	std::unordered_set<const identifier*> globalvars;
+
+	std::vector<const identifier*> globals;
+	std::unordered_set<const identifier*> seen_globals;
+	void add_global(const identifier *name);
+
+	std::unordered_map<const identifier*, std::set<size_t>> calls;
+
+	// reset for each program, since locals belong to a single function
+	std::unordered_set<const identifier*> locals;
+	int with_depth = 0;
+};
+
+#endif
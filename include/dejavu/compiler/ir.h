@@ -0,0 +1,125 @@
+#ifndef IR_H
+#define IR_H
+
+#include <dejavu/compiler/lexer.h>
+#include <memory>
+#include <vector>
+#include <ostream>
+
+struct identifier;
+struct ir_block;
+
+// a small ssa form between the ast and llvm, where the runtime's work is
+// spelled out as instructions, so gml passes can see and move it
+
+enum ir_type {
+	ir_void,
+	ir_real, // an unboxed double
+	ir_variant, // a whole variant, held as its tag and payload
+	ir_var, // the address of a variable
+	ir_address, // the address of one of a variable's elements
+};
+
+enum ir_opcode {
+	op_real, op_string,
+
+	// variables that live in memory
+	op_lookup, // an unqualified name that isn't an ssa local
+	op_slot, // a name codegen has already bound to a variant
+	op_access, // the first element of a variable
+	op_load, op_store,
+
+	op_retain, op_release,
+
+	op_box, op_unbox,
+	op_real_unary, op_real_binary,
+
+	// the runtime's operators, for operands that may not be reals
+	op_unary, op_binary,
+
+	op_call,
+	op_phi,
+
+	// terminators. exit falls through to the function's epilogue
+	op_jump, op_branch, op_return, op_exit,
+};
+
+struct ir_inst {
+	ir_inst(ir_opcode opcode, ir_type type) : opcode(opcode), type(type) {}
+
+	bool is_terminator() const { return opcode >= op_jump; }
+
+	// whether it can be removed when nothing uses its result
+	bool is_pure() const;
+
+	ir_opcode opcode;
+	ir_type type;
+	ir_block *parent = 0;
+
+	// phis take one operand per entry in targets
+	std::vector<ir_inst*> operands;
+	std::vector<ir_block*> targets;
+
+	double real = 0;
+	const char *data = 0;
+	size_t length = 0;
+	const identifier *name = 0;
+	token_type op = unexpected;
+	bool lvalue = false;
+};
+
+struct ir_block {
+	explicit ir_block(const char *label) : label(label) {}
+
+	ir_inst *terminator() const {
+		return !insts.empty() && insts.back()->is_terminator() ?
+			insts.back().get() : 0;
+	}
+
+	const char *label;
+	std::vector<std::unique_ptr<ir_inst>> insts;
+	std::vector<ir_block*> preds;
+};
+
+struct ir_function {
+	ir_block *entry() const { return blocks.front().get(); }
+	ir_block *add_block(const char *label);
+
+	void replace_uses(ir_inst *of, ir_inst *with);
+	size_t count(ir_opcode opcode) const;
+
+	// reachable blocks, each after all of its dominators
+	std::vector<ir_block*> reverse_postorder() const;
+
+	std::vector<std::unique_ptr<ir_block>> blocks;
+};
+
+std::ostream &operator <<(std::ostream &o, const ir_function &f);
+
+class ir_pass {
+public:
+	virtual ~ir_pass() {}
+
+	// returns whether the function changed
+	virtual bool run(ir_function &f) = 0;
+};
+
+class ir_pass_manager {
+public:
+	void add(std::unique_ptr<ir_pass> pass) { passes.push_back(std::move(pass)); }
+
+	// runs the passes in order, repeating until none of them change anything
+	void run(ir_function &f);
+
+private:
+	std::vector<std::unique_ptr<ir_pass>> passes;
+};
+
+// reuses lookups, accesses and loads within a block until something could
+// have moved or changed the variable, which llvm can't see through the runtime
+std::unique_ptr<ir_pass> create_redundant_lookups();
+
+// removes pure instructions nobody uses
+std::unique_ptr<ir_pass> create_dead_code();
+
+#endif
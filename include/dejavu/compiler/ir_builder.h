@@ -0,0 +1,110 @@
+#ifndef IR_BUILDER_H
+#define IR_BUILDER_H
+
+#include <dejavu/compiler/node_visitor.h>
+#include <dejavu/compiler/inference.h>
+#include <dejavu/compiler/ir.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class identifier_pool;
+
+// builds the ir for a function body, with scalar locals as ssa values
+// slots are names codegen has already bound to a variant, like the arguments
+// of a fixed arity clone. the ir doesn't cover everything yet, so build
+// returns false for bodies that need the ast path
+class ir_builder : public node_visitor<ir_builder, ir_inst*> {
+public:
+	ir_builder(
+		identifier_pool &names, const type_inference &types,
+		const std::unordered_set<const identifier*> &slots
+	);
+
+	bool build(node *body, ir_function &f);
+
+// really should be private
+	ir_inst *visit_expression_error(expression_error *e);
+	ir_inst *visit_value(value *v);
+	ir_inst *visit_unary(unary *u);
+	ir_inst *visit_binary(binary *b);
+	ir_inst *visit_subscript(subscript *s);
+	ir_inst *visit_call(call *c);
+
+	ir_inst *visit_statement_error(statement_error *e);
+	ir_inst *visit_assignment(assignment *a);
+	ir_inst *visit_invocation(invocation *i);
+	ir_inst *visit_declaration(declaration *d);
+	ir_inst *visit_block(block *b);
+
+	ir_inst *visit_ifstatement(ifstatement *i);
+	ir_inst *visit_whilestatement(whilestatement *w);
+	ir_inst *visit_dostatement(dostatement *d);
+	ir_inst *visit_repeatstatement(repeatstatement *r);
+	ir_inst *visit_forstatement(forstatement *f);
+	ir_inst *visit_switchstatement(switchstatement *s);
+	ir_inst *visit_withstatement(withstatement *w);
+
+	ir_inst *visit_jump(jump *j);
+	ir_inst *visit_returnstatement(returnstatement *r);
+	ir_inst *visit_casestatement(casestatement *c);
+
+private:
+	ir_inst *add(ir_opcode opcode, ir_type type);
+	ir_inst *add(ir_opcode opcode, ir_type type, ir_inst *a, ir_inst *b = 0);
+	ir_inst *add_real(double real);
+	ir_inst *unsupported();
+
+	ir_inst *expression_value(expression *e);
+	ir_inst *as_real(ir_inst *v);
+	ir_inst *as_variant(ir_inst *v);
+	ir_inst *address_of(const identifier *name, bool lvalue);
+
+	void jump_to(ir_block *target);
+	void branch(ir_inst *cond, ir_block *t, ir_block *f);
+	void condition(
+		expression *cond, ir_block *t, ir_block *f, bool nonzero = false
+	);
+	ir_inst *logical_value(binary *b);
+	bool is_reachable() const;
+	void start(ir_block *b);
+
+	// ssa construction, after braun et al., "simple and efficient
+	// construction of static single assignment form"
+	void declare(const void *key, ir_type type);
+	void write_variable(const void *key, ir_block *b, ir_inst *value);
+	ir_inst *read_variable(const void *key, ir_block *b);
+	ir_inst *read_variable_recursive(const void *key, ir_block *b);
+	ir_inst *add_phi(const void *key, ir_block *b);
+	ir_inst *add_phi_operands(const void *key, ir_inst *phi);
+	ir_inst *remove_trivial_phi(ir_inst *phi);
+	ir_inst *zero(ir_type type);
+	void seal(ir_block *b);
+
+	const type_inference &types;
+	const std::unordered_set<const identifier*> &slots;
+	const identifier *argument_name;
+	const identifier *argument_count_name;
+
+	ir_function *function = 0;
+	ir_block *current = 0;
+	bool supported = true;
+
+	// ssa locals, in the order they were declared
+	std::unordered_map<const identifier*, ir_type> locals;
+	std::vector<const identifier*> variants;
+
+	std::unordered_map<const void*, ir_type> variable_types;
+	std::unordered_map<const void*, std::unordered_map<ir_block*, ir_inst*>> defs;
+	std::unordered_set<ir_block*> sealed;
+	std::unordered_map<ir_block*, std::vector<std::pair<const void*, ir_inst*>>> incomplete;
+	std::unordered_set<ir_inst*> removed;
+
+	// phis that don't have all of their operands yet
+	std::unordered_set<ir_inst*> pending;
+
+	ir_block *current_loop = 0;
+	ir_block *current_end = 0;
+};
+
+#endif
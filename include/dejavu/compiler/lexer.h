@@ -2,9 +2,13 @@
 #define TOKEN_H
 
 #include <cstddef>
+#include <cstdint>
 #include <stdexcept>
+#include <vector>
 
 class buffer;
+class identifier_pool;
+struct identifier;
 
 enum token_type {
 #define TOK(X) X,
@@ -13,41 +17,54 @@ enum token_type {
 
 std::ostream &operator <<(std::ostream &o, token_type t);
 
+// names are interned; strings point to their text, wherever it lives
+// the position is a byte offset into the token's buffer, see token_stream::locate
 struct token {
 	token() {}
-	token(token_type t, size_t r, size_t c) : type(t), row(r), col(c) {}
+	token(token_type t, uint32_t p, uint32_t l = 0) :
+		type(t), length(l), position(p) {}
 
-	token_type type;
-	size_t row, col;
+	token_type type : 8;
+	uint32_t length : 24;
+	uint32_t position;
 
 	union {
 		double real;
-		struct {
-			size_t length;
-			const char *data;
-		} string;
+		const char *data;
+		const identifier *name;
 	};
 };
 
+// longer names and strings are lexed as unexpected tokens
+const uint32_t max_token_length = (1 << 24) - 1;
+
+struct source_location {
+	size_t row, col;
+};
+
 std::ostream &operator <<(std::ostream &o, const token &t);
 
 class token_stream {
 public:
-	token_stream(buffer &b);
+	token_stream(buffer &b, identifier_pool &names);
 	token gettoken();
+	source_location locate(const token &t);
 
 private:
 	// helper functions
 	void skipwhitespace();
 	bool skipcomment();
-	void skipnewline();
+	uint32_t offset() const;
 	token getname();
 	token getoperator();
 	token getnumber();
 	token getstring();
 
-	size_t row, col;
-	const char *current, *buffer_end;
+	const char *buffer_begin, *current, *buffer_end;
+	identifier_pool &names;
+
+	// offsets of the start of each line, built the first time it's needed
+	std::vector<uint32_t> lines;
 };
 
 #endif
@@ -1,7 +1,7 @@
 #ifndef NODE_H
 #define NODE_H
 
-#include <vector>
+#include <cstddef>
 #include <dejavu/compiler/lexer.h>
 
 enum node_type {
@@ -9,6 +9,23 @@ enum node_type {
 #include <dejavu/compiler/nodes.tbl>
 };
 
+// a node's children, stored contiguously in the same arena as the node
+template <typename T>
+struct node_list {
+	node_list() : items(0), count(0) {}
+	node_list(T *items, size_t count) : items(items), count(count) {}
+
+	T *begin() const { return items; }
+	T *end() const { return items + count; }
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T &operator[](size_t i) const { return items[i]; }
+
+	T *items;
+	size_t count;
+};
+
 struct node {
 	explicit node(node_type type) : type(type) {}
 
@@ -46,19 +63,19 @@ struct binary : public expression {
 };
 
 struct subscript : public expression {
-	subscript(expression *array, std::vector<expression*>& indices) :
+	subscript(expression *array, node_list<expression*> indices) :
 		expression(subscript_node), array(array), indices(indices) {}
 
 	expression *array;
-	std::vector<expression*> indices;
+	node_list<expression*> indices;
 };
 
 struct call : public expression {
-	call(value *function, std::vector<expression*>& args) :
+	call(value *function, node_list<expression*> args) :
 		expression(call_node), function(function), args(args) {}
 
 	value *function;
-	std::vector<expression*> args;
+	node_list<expression*> args;
 };
 
 struct statement : public node {
@@ -84,18 +101,18 @@ struct invocation : public statement {
 };
 
 struct declaration : public statement {
-	declaration(token type, std::vector<value*>& names) :
+	declaration(token type, node_list<value*> names) :
 		statement(declaration_node), type(type), names(names) {}
 
 	token type;
-	std::vector<value*> names;
+	node_list<value*> names;
 };
 
 struct block : public statement {
-	block(std::vector<statement*>& stmts) :
+	block(node_list<statement*> stmts) :
 		statement(block_node), stmts(stmts) {}
 
-	std::vector<statement*> stmts;
+	node_list<statement*> stmts;
 };
 
 struct ifstatement : public statement {
@@ -6,16 +6,44 @@
 #include <dejavu/system/arena.h>
 #include <dejavu/compiler/error_stream.h>
 #include <exception>
-#include <vector>
-#include <map>
 #include <algorithm>
+#include <cstring>
+
+// builds a node_list in the arena, so parsing never touches the general heap
+// the list is copied to a bigger block as it grows, like a vector
+template <typename T>
+class list_builder {
+public:
+	list_builder(arena &allocator) :
+		allocator(allocator), items(0), count(0), capacity(0) {}
+
+	void push_back(const T &item) {
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 4;
+			T *grown = static_cast<T*>(
+				allocator.allocate(capacity * sizeof(T), alignof(T))
+			);
+			if (count) memcpy(grown, items, count * sizeof(T));
+			items = grown;
+		}
+		items[count++] = item;
+	}
+
+	operator node_list<T>() const { return node_list<T>(items, count); }
+
+private:
+	arena &allocator;
+	T *items;
+	size_t count, capacity;
+};
 
 class parser {
-	friend class symbol_table;
+	friend struct symbol_table;
 
 public:
 	parser(token_stream& l, arena &allocator, error_stream& e);
 	node *getprogram();
+	expression *getargument();
 
 private:
 	// expressions
@@ -26,7 +54,7 @@ private:
 	expression *prefix_nud(token t);
 	expression *paren_nud(token t);
 
-	expression *null_nud(token t) { return error_expr(unexpected_token_error(t, "expression")); }
+	expression *null_nud(token t) { return error_expr(unexpected_token(t, "expression")); }
 
 	expression *infix_led(token t, expression *left);
 	expression *dot_led(token t, expression *left);
@@ -52,12 +80,17 @@ private:
 	statement *return_std();
 	statement *case_std();
 
-	statement *null_std() { return error_stmt(unexpected_token_error(current, "statement")); }
+	statement *null_std() { return error_stmt(unexpected_token(current, "statement")); }
 
 	// utilities
 	token advance();
 	token advance(token_type t);
 
+	template <typename E>
+	unexpected_token_error unexpected_token(token t, E expected) {
+		return unexpected_token_error(t, lexer.locate(t), expected);
+	}
+
 	statement_error *error_stmt(const unexpected_token_error&);
 	expression_error *error_expr(const unexpected_token_error&);
 
@@ -79,15 +112,23 @@ struct symbol {
 	led_parser led;
 };
 
-class symbol_table : public std::map<token_type, symbol> {
-public:
-	symbol_table();
+// the number of token types, for tables indexed by token_type
+constexpr size_t token_count = 0
+#define TOK(X) + 1
+#include <dejavu/compiler/tokens.tbl>
+;
 
-private:
-	void prefix(token_type t, nud_parser nud = &parser::prefix_nud);
-	void infix(token_type t, int prec, led_parser led = &parser::infix_led);
+// a dense table of symbols indexed by token type, built at compile time
+struct symbol_table {
+	constexpr const symbol &operator [](token_type t) const { return table[t]; }
+
+	static constexpr symbol get(token_type t);
+	static constexpr symbol prefix(nud_parser nud = &parser::prefix_nud);
+	static constexpr symbol infix(int prec, led_parser led = &parser::infix_led);
+
+	symbol table[token_count];
 };
 
-extern symbol_table symbols;
+extern const symbol_table symbols;
 
 #endif
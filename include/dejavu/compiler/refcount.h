@@ -0,0 +1,15 @@
+#ifndef REFCOUNT_H
+#define REFCOUNT_H
+
+namespace llvm {
+	class FunctionPass;
+}
+
+// removes the runtime's reference counting where it can't do anything:
+// retains and releases of variants that hold a real, retain_vars of empty
+// locals, and retains whose matching release follows before anything else
+// could free a string. it expects code straight from codegen, before the
+// runtime is linked in and inlined
+llvm::FunctionPass *create_refcount_elimination();
+
+#endif
@@ -2,41 +2,103 @@
 #define LINKER_H
 
 #include <dejavu/compiler/codegen.h>
+#include <dejavu/system/arena.h>
+#include <vector>
+#include <string>
+#include <set>
+#include <atomic>
 
 struct game;
+struct event;
 struct error_stream;
 
 namespace llvm {
 	class DataLayout;
+	class MemoryBuffer;
 }
 
 class linker {
 public:
 	linker(
 		const char *output, game&, error_stream&,
-		const std::string &triple, llvm::LLVMContext &context
+		const std::string &triple, llvm::LLVMContext &context,
+		unsigned jobs = 1, const char *cache = 0, bool ir = false
 	);
+	~linker();
+
 	bool build(const char *target, bool debug);
 
 private:
 	bool link(const char *target, bool debug);
 
 	void build_libraries();
+	void build_layouts();
 	void build_scripts();
 	void build_objects();
 
+	// a function waiting to be compiled, from either GML or an event's actions
+	struct unit {
+		std::string name;
+		std::string code;
+		int args;
+		bool var;
+		const event *actions;
+		const instance_layout *self;
+
+		// a script's fixed arity clone, whose errors the script already reports
+		bool clone;
+	};
+
+	bool load_libraries(const std::string &hash);
+	void save_libraries(llvm::Module &libraries, const std::string &hash);
+	std::string library_hash();
+	std::string library_path();
+
 	void add_function(
-		size_t length, const char *code,
-		const std::string &name, int args, bool var
+		node_codegen &compiler, size_t length, const char *code,
+		const std::string &name, int args, bool var,
+		const instance_layout *self = 0, bool clone = false
+	);
+	void add_event(
+		node_codegen &compiler, const event &evt, const std::string &name,
+		const instance_layout *self = 0
 	);
 
+	void compile_parallel(llvm::Module &dest);
+	struct result;
+	void compile_worker(std::vector<result> &results);
+
+	void compile_unit(const unit&, node_codegen&, arena&, error_stream&);
+	void register_scripts(node_codegen&);
+	void register_globals(node_codegen&);
+
+	std::string cache_path(const unit&);
+	bool load_cached(const std::string &path, std::string &bitcode);
+	void store_cached(const std::string &path, const std::string &bitcode);
+
 	llvm::LLVMContext &context;
+	std::unique_ptr<llvm::MemoryBuffer> runtime_file;
 	std::unique_ptr<llvm::Module> runtime;
 	const char *output;
 
 	game &source;
 	error_stream &errors;
 	node_codegen compiler;
+
+	unsigned jobs;
+	std::string cache;
+	bool ir;
+	std::string runtime_hash;
+
+	arena allocator;
+	std::vector<unit> units;
+	std::vector<instance_layout> layouts;
+	instance_layout globals;
+	std::vector<std::string> globalvars;
+	std::unordered_map<std::string, std::set<size_t>> arities;
+	std::atomic<size_t> next_unit;
+	bool scripts_registered = false;
+	bool globals_registered = false;
 };
 
 #endif
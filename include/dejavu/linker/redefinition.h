@@ -0,0 +1,14 @@
+#ifndef REDEFINITION_H
+#define REDEFINITION_H
+
+namespace llvm {
+	class Module;
+	class Function;
+}
+
+// whether linking a unit's function into dest would clash with a definition
+// already there. internal functions never clash, since llvm's linker renames
+// them- every module with a string literal has its own intern_strings
+bool redefines(const llvm::Module &dest, const llvm::Function &f);
+
+#endif
@@ -5,8 +5,10 @@
 
 struct scope;
 
+// functions gml calls take variants by value, so their tag and payload are
+// passed in a pair of registers
 extern "C" variant show_error(
-	scope *self, scope *other, const variant &msg, const variant &abort
+	scope *self, scope *other, variant msg, variant abort
 );
 
 #endif
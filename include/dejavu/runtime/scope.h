@@ -4,6 +4,67 @@
 #include <dejavu/runtime/variant.h>
 #include <dejavu/system/table.h>
 
-struct scope : public table<string*, var> {};
+// the variables an instance has, in slot order. instances that gain the same
+// variables in the same order share a layout, so a lookup site can remember
+// where it found a name by remembering the layout.
+// an object's static layout comes from the compiler, and a child's starts with
+// its parent's, so code compiled for the parent can run on the child's instances
+struct layout {
+	size_t nslots;
+	string **names;
+
+	// layouts with one more variable, created as instances need them
+	table<string*, layout*> *transitions;
+
+	// slots by name, built the first time a lookup has to search this layout
+	// compiled code addresses the static slots directly, so small layouts
+	// that are never searched never build one
+	table<string*, size_t> *index;
+
+	layout *add(string *name);
+	ptrdiff_t find(string *name);
+};
+
+struct scope {
+	scope(layout *shape = 0);
+	~scope();
+
+	// the slot holding a variable, or -1 if this instance doesn't have it
+	ptrdiff_t find_slot(string *name);
+	var *find(string *name);
+	var *insert(string *name);
+
+	layout *shape;
+	var *slots;
+	size_t capacity;
+};
+
+// the globals the game names at compile time come first, so generated code
+// can address them directly
+extern "C" layout global_layout;
+extern "C" scope global_scope;
+
+// remembers where one call site last found its variable
+struct lookup_cache {
+	layout *shape;
+	size_t slot;
+	size_t generation;
+};
+
+extern "C" {
+	var *lookup(
+		scope *self, scope *other, double id, string *name, bool lvalue,
+		lookup_cache *cache
+	);
+	var *lookup_default(
+		scope *self, scope *other, string *name, bool lvalue, lookup_cache *cache
+	);
+}
+
+// build the runtime with DEJAVU_LOOKUP_STATS to count how well sites cache
+struct lookup_counters {
+	size_t hits, misses;
+};
+extern "C" lookup_counters lookup_stats;
 
 #endif
@@ -6,7 +6,7 @@
 struct scope;
 
 extern "C" variant string(
-	scope *self, scope *other, const variant &val
+	scope *self, scope *other, variant val
 );
 
 #endif
@@ -9,7 +9,7 @@ struct variant {
 	variant() = default;
 
 	variant(double r) : type(0), real(r) {}
-	variant(string *s) : type(1), string(s) {}
+	variant(struct string *s) : type(1), string(s) {}
 
 	variant(const char *s) : variant(strings.intern(s)) {}
 
@@ -17,7 +17,7 @@ struct variant {
 	unsigned char type;
 	union {
 		double real;
-		string *string;
+		struct string *string;
 	};
 };
 
@@ -30,7 +30,7 @@ extern "C" {
 	double to_real(const variant &a);
 	string *to_string(const variant &a);
 
-	string *intern(string *s) __attribute__((pure));
+	string *intern(string *s);
 
 	variant *access(
 		var *a, unsigned short x, unsigned short y, bool lvalue = false
@@ -3,29 +3,52 @@
 
 #include <cstddef>
 
+/*
+ * bump allocator over a list of slabs that grow geometrically
+ * allocations too big to share a slab get one of their own, and reset()
+ * keeps the regular slabs around so one arena can be reused indefinitely
+ */
 class arena {
 public:
 	arena(size_t slab_size = 4096);
 	~arena();
 
-	void *allocate(size_t s);
+	arena(const arena&) = delete;
+	arena &operator=(const arena&) = delete;
+
+	void *allocate(size_t s, size_t align = alignof(std::max_align_t));
 	void reset();
 
+	size_t bytes_allocated() const { return allocated; }
+	size_t bytes_reserved() const { return reserved; }
+	size_t slab_count() const { return slabs; }
+
 private:
-	struct slab {
+	struct alignas(std::max_align_t) slab {
 		size_t size;
 		slab *next;
 	};
 
-	void new_slab();
+	void next_slab();
+	void *allocate_large(size_t s, size_t align);
+
+	slab *create_slab(size_t size);
+	void destroy_slabs(slab *s);
 
 	size_t slab_size;
+	size_t next_size;
+
+	// regular slabs in order of use, followed by any retained by reset()
+	slab *first_slab;
 	slab *current_slab;
+	slab *large_slabs;
+
 	char *current;
 	char *end;
-	size_t bytes_allocated;
 
-	size_t offset = 0;
+	size_t allocated;
+	size_t reserved;
+	size_t slabs;
 };
 
 inline void *operator new (size_t size, arena &a) {
@@ -1,9 +1,14 @@
 #include <dejavu/linker/linker.h>
 #include <dejavu/linker/game.h>
+#include <dejavu/linker/redefinition.h>
 
 #include <dejavu/compiler/lexer.h>
 #include <dejavu/compiler/parser.h>
+#include <dejavu/compiler/dnd.h>
+#include <dejavu/compiler/folder.h>
+#include <dejavu/compiler/instance.h>
 #include <dejavu/compiler/codegen.h>
+#include <dejavu/compiler/refcount.h>
 #include <dejavu/system/buffer.h>
 
 #include <llvm/PassManager.h>
@@ -23,10 +28,15 @@
 
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/MD5.h>
 
 #include <sstream>
 #include <algorithm>
 #include <memory>
+#include <functional>
+#include <thread>
+#include <set>
 
 using namespace llvm;
 
@@ -35,24 +45,117 @@ static Module *load_module(const char *filename, LLVMContext &context) {
 	return getLazyBitcodeModule(std::move(file), context).get();
 }
 
+// loads a module without taking ownership of its bitcode
+static Module *load_module(const MemoryBuffer &file, LLVMContext &context) {
+	std::unique_ptr<MemoryBuffer> ref = MemoryBuffer::getMemBuffer(
+		file.getBuffer(), file.getBufferIdentifier(), false
+	);
+	return getLazyBitcodeModule(std::move(ref), context).get();
+}
+
+static std::unique_ptr<MemoryBuffer> read_file(const char *filename) {
+	return std::move(MemoryBuffer::getFile(filename).get());
+}
+
+namespace {
+	// records a worker's errors so they can be reported in source order
+	class error_buffer : public error_stream {
+	public:
+		void set_context(const std::string &c) {
+			events.push_back([c](error_stream &e) { e.set_context(c); });
+		}
+		int count() { return errors; }
+
+		void error(const unexpected_token_error &e) {
+			// names point into the worker's pool, which is gone by the time
+			// errors are replayed, so they're interned again here
+			unexpected_token_error copy = e;
+			const identifier *name = e.unexpected.name;
+			if (e.unexpected.type == v_name)
+				copy.unexpected.name = names.intern(name->data, name->length);
+			record(copy);
+		}
+		void error(const redefinition_error &e) { record(e); }
+		void error(const unsupported_error &e) { record(e); }
+		void error(const std::string &e) { record(e); }
+
+		void progress(int, const std::string &) {}
+
+		void replay(error_stream &e) {
+			for (auto &event : events) event(e);
+		}
+
+	private:
+		template <typename error_type>
+		void record(const error_type &err) {
+			events.push_back([err](error_stream &e) { e.error(err); });
+			errors++;
+		}
+
+		std::vector<std::function<void(error_stream&)>> events;
+		int errors = 0;
+		identifier_pool names;
+	};
+}
+
+static void diagnostic_handler(const DiagnosticInfo &DI) {
+	fprintf(stderr, "AUGHERASER\n");
+}
+
+struct linker::result {
+	std::string bitcode;
+	error_buffer errors;
+};
+
 linker::linker(
 	const char *output, game &g, error_stream &e,
-	const std::string &triple, LLVMContext &context
-) : context(context), runtime(load_module("runtime.bc", context)),
-	output(output), source(g), errors(e), compiler(*runtime, errors) {
+	const std::string &triple, LLVMContext &context,
+	unsigned jobs, const char *cache, bool ir
+) : context(context), runtime_file(read_file("runtime.bc")),
+	runtime(load_module(*runtime_file, context)),
+	output(output), source(g), errors(e), compiler(*runtime, errors),
+	jobs(jobs ? jobs : std::max(1u, std::thread::hardware_concurrency())),
+	cache(cache ? cache : ""), ir(ir) {
 	verifyModule(*runtime);
+	compiler.set_ir(ir);
+
+	if (!this->cache.empty()) {
+		// the build still works without a cache, just without reuse
+		if (std::error_code error = sys::fs::create_directories(this->cache)) {
+			errors.progress(0, "not caching: " + error.message());
+			this->cache.clear();
+		}
+	}
+
+	// generated code depends on the runtime's types and declarations
+	MD5 hash;
+	hash.update(runtime_file->getBuffer());
+	MD5::MD5Result digest;
+	hash.final(digest);
+
+	SmallString<32> hex;
+	MD5::stringifyResult(digest, hex);
+	runtime_hash = hex.str();
 }
 
+linker::~linker() {}
+
 bool linker::build(const char *target, bool debug) {
 	errors.progress(20, "compiling libraries");
 	build_libraries();
 
 	errors.progress(30, "compiling scripts");
+	build_layouts();
 	build_scripts();
 
 	errors.progress(40, "compiling objects");
 	build_objects();
 
+	if (!units.empty()) {
+		errors.progress(50, "generating code");
+		compile_parallel(compiler.get_module());
+	}
+
 	if (errors.count() > 0) return false;
 
 	Module &game = compiler.get_module();
@@ -67,7 +170,11 @@ bool linker::build(const char *target, bool debug) {
 	}
 
 	if (!debug) {
+		// reference counting is easiest to see through before anything else
+		// has rearranged codegen's output
 		PassManager pm;
+		pm.add(create_refcount_elimination());
+
 		PassManagerBuilder pmb;
 		pmb.populateModulePassManager(pm);
 		pm.run(game);
@@ -92,21 +199,29 @@ bool linker::build(const char *target, bool debug) {
 	return errors.count() == 0;
 }
 
-static void diagnostic_handler(const DiagnosticInfo &DI) {
-	fprintf(stderr, "AUGHERASER\n");
-}
-
 bool linker::link(const char *target, bool debug) {
 	std::ostringstream f; f << output << "/objects.bc";
 	std::unique_ptr<Module> objects(load_module(f.str().c_str(), context));
 
+	std::unique_ptr<Module> libraries(
+		load_module(library_path().c_str(), context)
+	);
+
 	std::unique_ptr<Module> game = std::make_unique<Module>("game", context);
 	Linker L(game.get(), &diagnostic_handler);
-	if (L.linkInModule(objects.get()) || L.linkInModule(runtime.get()))
+	if (L.linkInModule(objects.get()) || L.linkInModule(libraries.get()))
+		errors.error("failed to link with libraries");
+	if (L.linkInModule(runtime.get()))
 		errors.error("failed to link with runtime");
 
 	if (!debug) {
+		// nothing outside the game calls into it but main, so everything else
+		// can be internal. that lets global opt move calls between scripts to
+		// fastcc and drop the arguments they don't use
+		const char *exports[] = { "main" };
 		PassManager pm;
+		pm.add(createInternalizePass(exports));
+
 		PassManagerBuilder pmb;
 		pmb.OptLevel = 3;
 		pmb.populateLTOPassManager(pm);
@@ -126,7 +241,14 @@ bool linker::link(const char *target, bool debug) {
 	return true;
 }
 
+// library actions don't depend on the game, so they are compiled into their
+// own module that is kept in the cache until the libraries change
 void linker::build_libraries() {
+	std::string hash = library_hash();
+	if (load_libraries(hash)) return;
+
+	node_codegen libraries(*runtime, errors);
+	libraries.set_ir(ir);
 	for (unsigned int i = 0; i < source.nactions; i++) {
 		if (source.actions[i].exec != action_type::exec_code)
 			continue;
@@ -139,27 +261,244 @@ void linker::build_libraries() {
 		size_t nargs = source.actions[i].nargs;
 		if (source.actions[i].relative) nargs++;
 		add_function(
-			strlen(source.actions[i].code), source.actions[i].code,
+			libraries, strlen(source.actions[i].code), source.actions[i].code,
 			name.str().c_str(), nargs, false
 		);
 	}
+
+	if (!units.empty()) compile_parallel(libraries.get_module());
+	if (errors.count() > 0) return;
+
+	save_libraries(libraries.get_module(), hash);
 }
 
-void linker::build_scripts() {
-	// first pass so the code generator knows which functions are scripts
+// identifies a set of libraries by everything their code depends on
+std::string linker::library_hash() {
+	MD5 hash;
+	hash.update(runtime_hash);
+
+	uint8_t options[] = { uint8_t(ir) };
+	hash.update(options);
+
+	for (unsigned int i = 0; i < source.nactions; i++) {
+		const action_type &type = source.actions[i];
+		if (type.exec != action_type::exec_code)
+			continue;
+
+		std::ostringstream s;
+		s << type.parent << " " << type.id << " " << type.nargs << " ";
+		s << type.relative << " " << strlen(type.code) << "\n" << type.code;
+		hash.update(s.str());
+	}
+
+	MD5::MD5Result digest;
+	hash.final(digest);
+
+	SmallString<32> hex;
+	MD5::stringifyResult(digest, hex);
+	return hex.str();
+}
+
+std::string linker::library_path() {
+	SmallString<128> path(cache.empty() ? std::string(output) : cache);
+	sys::path::append(path, "libraries.bc");
+	return path.str();
+}
+
+bool linker::load_libraries(const std::string &hash) {
+	ErrorOr<std::unique_ptr<MemoryBuffer>> file =
+		MemoryBuffer::getFile(library_path());
+	if (!file) return false;
+
+	std::unique_ptr<Module> libraries(
+		getLazyBitcodeModule(std::move(file.get()), context).get()
+	);
+	if (!libraries) return false;
+
+	NamedMDNode *node = libraries->getNamedMetadata("dejavu.libraries");
+	if (!node || node->getNumOperands() != 1) return false;
+
+	MDNode *operand = node->getOperand(0);
+	if (operand->getNumOperands() != 1) return false;
+
+	MDString *saved = dyn_cast<MDString>(operand->getOperand(0).get());
+	return saved && saved->getString() == hash;
+}
+
+void linker::save_libraries(Module &libraries, const std::string &hash) {
+	{
+		SmallString<80> str;
+		raw_svector_ostream error(str);
+		if (verifyModule(libraries, &error)) {
+			errors.error(error.str());
+			return;
+		}
+	}
+
+	NamedMDNode *node = libraries.getOrInsertNamedMetadata("dejavu.libraries");
+	node->addOperand(MDNode::get(context, MDString::get(context, hash)));
+
+	std::error_code error;
+	tool_output_file out(library_path(), error, sys::fs::F_None);
+	if (error) {
+		errors.error(error.message());
+		return;
+	}
+
+	WriteBitcodeToFile(&libraries, out.os());
+	out.keep();
+}
+
+void linker::register_scripts(node_codegen &compiler) {
 	for (unsigned int i = 0; i < source.nscripts; i++) {
 		compiler.register_script(std::string(source.scripts[i].name));
 	}
+}
 
+// gives each object a slot for every instance variable its events use,
+// after the slots it inherits from its parent. names declared globalvar
+// anywhere in the game are left out, since they never live in an instance.
+// the globals the game names with global.x or globalvar get the same treatment.
+// this also finds the arities functions are called with, to clone scripts for
+void linker::build_layouts() {
+	// errors are reported when each unit is compiled for real
+	identifier_pool names;
+	error_buffer ignored;
+	arena allocator;
+
+	instance_variables globals;
+	auto parse = [&](instance_variables &uses, const char *code) {
+		allocator.reset();
+		buffer b(strlen(code), code);
+		token_stream tokens(b, names);
+		parser p(tokens, allocator, ignored);
+		uses.collect(p.getprogram());
+	};
+
+	for (unsigned int i = 0; i < source.nactions; i++) {
+		if (source.actions[i].exec == action_type::exec_code)
+			parse(globals, source.actions[i].code);
+	}
 	for (unsigned int i = 0; i < source.nscripts; i++) {
-		add_function(
-			strlen(source.scripts[i].code), source.scripts[i].code,
-			source.scripts[i].name, 0, true
+		parse(globals, source.scripts[i].code);
+	}
+
+	std::vector<instance_variables> uses(source.nobjects);
+	std::unordered_map<int, size_t> objects;
+	for (unsigned int i = 0; i < source.nobjects; i++) {
+		object &obj = source.objects[i];
+		objects[obj.id] = i;
+
+		for (unsigned int e = 0; e < obj.nevents; e++) {
+			event &evt = obj.events[e];
+			for (unsigned int a = 0; a < evt.nactions; a++) {
+				action &act = evt.actions[a];
+				if (act.type->kind == action_type::act_code)
+					parse(uses[i], act.args[0].val);
+			}
+
+			allocator.reset();
+			action_parser p(evt, obj.name, allocator, names, ignored);
+			uses[i].collect(p.getprogram());
+		}
+	}
+
+	std::unordered_set<const identifier*> globalvars(
+		globals.get_globalvars().begin(), globals.get_globalvars().end()
+	);
+	for (auto &u : uses) {
+		globalvars.insert(u.get_globalvars().begin(), u.get_globalvars().end());
+	}
+
+	std::set<std::string> seen;
+	auto add_globals = [&](const instance_variables &uses) {
+		for (const identifier *name : uses.get_globals()) {
+			std::string n(name->data, name->length);
+			if (!seen.insert(n).second) continue;
+
+			this->globals.push_back(n);
+			if (globalvars.count(name)) this->globalvars.push_back(n);
+		}
+	};
+	add_globals(globals);
+	for (auto &u : uses) add_globals(u);
+
+	auto add_calls = [&](const instance_variables &uses) {
+		for (auto &call : uses.get_calls()) {
+			std::string name(call.first->data, call.first->length);
+			arities[name].insert(call.second.begin(), call.second.end());
+		}
+	};
+	add_calls(globals);
+	for (auto &u : uses) add_calls(u);
+
+	register_globals(compiler);
+	globals_registered = true;
+	compiler.add_layout("global_layout", this->globals);
+
+	// parents are laid out first; a cycle is cut where it's found
+	enum { pending, visiting, done };
+	std::vector<int> state(source.nobjects, pending);
+	layouts.assign(source.nobjects, instance_layout());
+	std::function<void(size_t)> lay_out = [&](size_t i) {
+		if (state[i] != pending) return;
+		state[i] = visiting;
+
+		auto parent = objects.find(source.objects[i].parent);
+		if (parent != objects.end()) {
+			lay_out(parent->second);
+			if (state[parent->second] == done) layouts[i] = layouts[parent->second];
+		}
+
+		std::set<std::string> inherited(layouts[i].begin(), layouts[i].end());
+		for (const identifier *name : uses[i].get_names()) {
+			if (globalvars.find(name) != globalvars.end()) continue;
+
+			std::string n(name->data, name->length);
+			if (inherited.insert(n).second) layouts[i].push_back(n);
+		}
+
+		state[i] = done;
+	};
+
+	for (unsigned int i = 0; i < source.nobjects; i++) {
+		lay_out(i);
+		compiler.add_layout(
+			std::string(source.objects[i].name) + "_layout", layouts[i]
 		);
 	}
 }
 
-std::ostream &operator <<(std::ostream &out, const argument &arg);
+void linker::register_globals(node_codegen &compiler) {
+	compiler.register_globals(globals, globalvars);
+}
+
+void linker::build_scripts() {
+	// first pass so the code generator knows which functions are scripts
+	register_scripts(compiler);
+	scripts_registered = true;
+
+	for (unsigned int i = 0; i < source.nscripts; i++) {
+		script &scr = source.scripts[i];
+		size_t length = strlen(scr.code);
+
+		// the var-arg entry is for the runtime and calls with too many arguments
+		add_function(compiler, length, scr.code, scr.name, 0, true);
+
+		// a clone's parse errors were already reported for the var arg entry,
+		// but codegen's errors in a clone still belong to the script
+		errors.set_context(scr.name);
+		for (size_t nargs : arities[scr.name]) {
+			if (nargs > node_codegen::max_arguments) continue;
+
+			add_function(
+				compiler, length, scr.code,
+				node_codegen::clone_name(scr.name, nargs), nargs, false, 0, true
+			);
+		}
+	}
+}
+
 void linker::build_objects() {
 	for (unsigned int i = 0; i < source.nobjects; i++) {
 		object &obj = source.objects[i];
@@ -169,125 +508,275 @@ void linker::build_objects() {
 			event &evt = obj.events[e];
 			// todo: output event data
 
-			// todo: move this into compiler
-			std::ostringstream code;
+			std::ostringstream s;
+			s << obj.name << "_" << evt.main_id << "_" << evt.sub_id;
+
+			// code actions are compiled separately and called from the event
 			for (unsigned int a = 0; a < evt.nactions; a++) {
 				action &act = evt.actions[a];
-
-				// todo: don't do this by unparsing and reparsing
-				switch (act.type->kind) {
-				case action_type::act_begin: code << "{\n"; break;
-				case action_type::act_end: code << "}\n"; break;
-				case action_type::act_else: code << "else\n"; break;
-				case action_type::act_exit: code << "exit\n"; break;
-
-				case action_type::act_repeat:
-					code << "repeat (" << act.args[0].val << ")\n";
-					break;
-				case action_type::act_variable:
-					code
-						<< act.args[0].val
-						<< (act.relative ? " += " : " = ")
-						<< act.args[1].val << "\n";
-					break;
-
-				case action_type::act_code: {
-					std::ostringstream s;
-					s << obj.name << "_" << evt.main_id << "_" << evt.sub_id << "_" << a;
-					add_function(strlen(act.args[0].val), act.args[0].val, s.str(), 0, false);
-
-					code << s.str() << "()\n";
-					break;
-				}
-
-				case action_type::act_normal: {
-					if (act.type->exec == action_type::exec_none) break;
-
-					if (act.target != action::self) code << "with (" << act.target << ")";
-					if (act.type->question) code << "if (";
-					if (act.inv) code << '!';
-
-					if (act.type->exec == action_type::exec_code) {
-						code << "action_lib";
-						if (act.type->parent > -1) code << act.type->parent;
-						code << "_" << act.type->id;
-					}
-					else
-						code << act.type->code;
-
-					code << '(';
-					unsigned int n = 0;
-					for (; n < act.nargs; n++) {
-						if (n != 0) code << ", ";
-						code << act.args[n];
-					}
-					if (act.type->relative) {
-						code << ", " << act.relative;
-					}
-					code << ')';
-
-					if (act.type->question) code << ')';
-
-					code << '\n';
-					break;
-				}
-
-				default: /* do nothing */;
-				}
+				if (act.type->kind != action_type::act_code) continue;
+
+				std::ostringstream c;
+				c << s.str() << "_" << a;
+				add_function(
+					compiler, strlen(act.args[0].val), act.args[0].val,
+					c.str(), 0, false, &layouts[i]
+				);
 			}
 
-			std::ostringstream s;
-			s << obj.name << "_" << evt.main_id << "_" << evt.sub_id;
-			std::string c = code.str();
-			add_function(c.size(), c.c_str(), s.str(), 0, false);
+			add_event(compiler, evt, s.str(), &layouts[i]);
 		}
 	}
 }
 
-std::ostream &operator <<(std::ostream &out, const argument &arg) {
-	switch (arg.kind) {
-	case argument::arg_expr:
-		return out << arg.val;
+void linker::add_function(
+	node_codegen &compiler, size_t length, const char *data,
+	const std::string &name, int args, bool var, const instance_layout *self,
+	bool clone
+) {
+	unit u = { name, std::string(data, length), args, var, 0, self, clone };
+	if (jobs > 1 || !cache.empty()) {
+		units.push_back(std::move(u));
+		return;
+	}
 
-	case argument::arg_both:
-		if (arg.val[0] == '"' || arg.val[0] == '\'') return out << arg.val;
+	compile_unit(u, compiler, allocator, errors);
+}
 
-	// fall through
-	case argument::arg_string: {
-		std::string val(arg.val);
-		while (val.find('"') != std::string::npos) {
-			val.replace(val.find('"'), 1, "\"+'\"'+\"");
-		}
-		return out << '"' << val << '"';
+void linker::add_event(
+	node_codegen &compiler, const event &evt, const std::string &name,
+	const instance_layout *self
+) {
+	unit u = { name, std::string(), 0, false, &evt, self, false };
+	if (jobs > 1 || !cache.empty()) {
+		units.push_back(std::move(u));
+		return;
 	}
 
-	case argument::arg_bool:
-		return out << (arg.val[0] == '0');
+	compile_unit(u, compiler, allocator, errors);
+}
 
-	case argument::arg_menu:
-		return out << arg.val;
+// the arena is reset for each unit, so its slabs are reused across a build
+void linker::compile_unit(
+	const unit &u, node_codegen &compiler, arena &allocator,
+	error_stream &unit_errors
+) {
+	error_buffer ignored;
+	error_stream &errors = u.clone ? ignored : unit_errors;
 
-	case argument::arg_color:
-		return out << '$' << arg.val;
+	allocator.reset();
+	errors.set_context(u.name);
 
-	default:
-		return out << arg.resource;
+	node *program;
+	if (u.actions) {
+		action_parser parser(
+			*u.actions, u.name, allocator, compiler.get_names(), errors
+		);
+		program = parser.getprogram();
 	}
+	else {
+		buffer code(u.code.size(), u.code.data());
+		token_stream tokens(code, compiler.get_names());
+
+		parser parser(tokens, allocator, errors);
+		program = parser.getprogram();
+	}
+	if (errors.count() > 0) return;
+
+	node_folder folder(allocator, compiler.get_names());
+	program = folder.fold(program);
+
+	compiler.add_function(program, u.name.c_str(), u.args, u.var, u.self);
 }
 
-void linker::add_function(
-	size_t length, const char *data,
-	const std::string &name, int args, bool var
-) {
-	buffer code(length, data);
-	token_stream tokens(code);
+// compiles queued units on a pool of threads, each with its own context and
+// module, then links the results back together in the order they were queued
+void linker::compile_parallel(Module &dest) {
+	std::vector<result> results(units.size());
+
+	next_unit = 0;
+	std::vector<std::thread> workers;
+	size_t n = std::min<size_t>(jobs, units.size());
+	for (size_t i = 0; i < n; i++) {
+		workers.emplace_back(&linker::compile_worker, this, std::ref(results));
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+
+	Linker L(&dest, &diagnostic_handler);
+	for (size_t i = 0; i < units.size(); i++) {
+		results[i].errors.replay(errors);
+		if (results[i].errors.count() > 0) continue;
+
+		MemoryBufferRef bitcode(results[i].bitcode, units[i].name);
+		std::unique_ptr<Module> module(
+			parseBitcodeFile(bitcode, context).get()
+		);
+
+		// the serial path keeps the first definition, so do the same here
+		bool redefined = false;
+		for (Function &f : *module) {
+			if (redefines(dest, f)) {
+				errors.set_context(units[i].name);
+				errors.error(redefinition_error(f.getName()));
+				redefined = true;
+			}
+		}
+		if (redefined) continue;
+
+		if (L.linkInModule(module.get()))
+			errors.error("failed to link " + units[i].name);
+	}
 
+	units.clear();
+}
+
+void linker::compile_worker(std::vector<result> &results) {
+	LLVMContext context;
+	std::unique_ptr<Module> runtime(load_module(*runtime_file, context));
 	arena allocator;
-	parser parser(tokens, allocator, errors);
-	errors.set_context(name);
 
-	node *program = parser.getprogram();
-	if (errors.count() > 0) return;
+	for (size_t i; (i = next_unit++) < units.size(); ) {
+		error_buffer &errors = results[i].errors;
+
+		std::string path;
+		if (!cache.empty()) {
+			path = cache_path(units[i]);
+			if (load_cached(path, results[i].bitcode)) continue;
+		}
+
+		node_codegen compiler(*runtime, errors);
+		compiler.set_ir(ir);
+		if (scripts_registered) register_scripts(compiler);
+		if (globals_registered) register_globals(compiler);
+		compile_unit(units[i], compiler, allocator, errors);
+		if (errors.count() > 0) continue;
+
+		raw_string_ostream out(results[i].bitcode);
+		WriteBitcodeToFile(&compiler.get_module(), out);
+		out.flush();
+
+		if (!path.empty()) store_cached(path, results[i].bitcode);
+	}
+}
+
+// a unit's cache entry is named by a hash of everything its code depends on:
+// the runtime, its name and source, its signature, and which of the names it
+// uses are scripts, instance variable slots, globals or globalvars, since that
+// decides how they are generated
+std::string linker::cache_path(const unit &u) {
+	MD5 hash;
+	hash.update(runtime_hash);
+	hash.update(StringRef(u.name.c_str(), u.name.size() + 1));
+	hash.update(StringRef(u.code.c_str(), u.code.size() + 1));
+
+	uint8_t signature[] = {
+		uint8_t(u.args), uint8_t(u.args >> 8), uint8_t(u.var),
+		uint8_t(globals_registered), uint8_t(ir)
+	};
+	hash.update(signature);
+
+	// this runs on worker threads, so it can't intern into the compiler's pool
+	identifier_pool names;
+	std::set<std::string> scripts;
+	std::set<std::pair<std::string, size_t>> slots;
+	std::set<std::string> global_names;
+	std::unordered_map<std::string, size_t> layout;
+	if (u.self) {
+		for (size_t i = 0; i < u.self->size(); i++) layout[(*u.self)[i]] = i;
+	}
+	auto add_scripts = [&](size_t length, const char *data) {
+		buffer code(length, data);
+		token_stream tokens(code, names);
+		for (token t = tokens.gettoken(); t.type != eof; t = tokens.gettoken()) {
+			if (t.type != v_name) continue;
+
+			std::string name(t.name->data, t.name->length);
+			if (compiler.is_script(name)) scripts.insert(name);
+
+			auto slot = layout.find(name);
+			if (slot != layout.end()) slots.insert(*slot);
+
+			if (globals_registered) {
+				std::ostringstream s;
+				s << name << " " << compiler.global_slot(name) << " ";
+				s << compiler.is_globalvar(name) << "\n";
+				global_names.insert(s.str());
+			}
+		}
+	};
+	add_scripts(u.code.size(), u.code.data());
+
+	// events have no source, so hash everything their actions are built from
+	if (u.actions) {
+		std::ostringstream s;
+		for (unsigned int a = 0; a < u.actions->nactions; a++) {
+			const action &act = u.actions->actions[a];
+			const action_type &type = *act.type;
+
+			s << type.kind << " " << type.exec << " " << type.parent << " ";
+			s << type.id << " " << type.question << " " << type.relative << " ";
+			s << act.relative << " " << act.inv << " " << act.target << " ";
+			if (type.exec == action_type::exec_function) {
+				s << strlen(type.code) << ":" << type.code << " ";
+				add_scripts(strlen(type.code), type.code);
+			}
+
+			s << act.nargs << "\n";
+			for (unsigned int n = 0; n < act.nargs; n++) {
+				const argument &arg = act.args[n];
+				s << arg.kind << " " << arg.resource << " ";
+				s << strlen(arg.val) << ":" << arg.val << "\n";
+				add_scripts(strlen(arg.val), arg.val);
+			}
+		}
+		hash.update(s.str());
+	}
+
+	for (const std::string &name : scripts) {
+		hash.update(StringRef(name.c_str(), name.size() + 1));
+	}
+	hash.update(StringRef("", 1));
+	for (auto &slot : slots) {
+		std::ostringstream s;
+		s << slot.first << " " << slot.second << "\n";
+		hash.update(s.str());
+	}
+	hash.update(StringRef("", 1));
+	for (const std::string &global : global_names) hash.update(global);
+
+	MD5::MD5Result digest;
+	hash.final(digest);
+
+	SmallString<32> hex;
+	MD5::stringifyResult(digest, hex);
+
+	SmallString<128> path(cache);
+	sys::path::append(path, hex.str() + ".bc");
+	return path.str();
+}
+
+bool linker::load_cached(const std::string &path, std::string &bitcode) {
+	ErrorOr<std::unique_ptr<MemoryBuffer>> file = MemoryBuffer::getFile(path);
+	if (!file) return false;
+
+	bitcode = file.get()->getBuffer();
+	return true;
+}
+
+// entries are written to a unique file and renamed into place so that
+// concurrent builds never see a partial entry
+void linker::store_cached(const std::string &path, const std::string &bitcode) {
+	int fd;
+	SmallString<128> temp;
+	if (sys::fs::createUniqueFile(path + ".%%%%%%", fd, temp)) return;
+
+	{
+		raw_fd_ostream out(fd, true);
+		out << bitcode;
+	}
 
-	compiler.add_function(program, name.c_str(), args, var);
+	if (sys::fs::rename(temp.str(), path))
+		sys::fs::remove(temp.str());
 }
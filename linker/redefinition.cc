@@ -0,0 +1,11 @@
+#include <dejavu/linker/redefinition.h>
+#include <llvm/IR/Module.h>
+
+using namespace llvm;
+
+bool redefines(const Module &dest, const Function &f) {
+	if (f.isDeclaration() || f.hasLocalLinkage()) return false;
+
+	const Function *existing = dest.getFunction(f.getName());
+	return existing && !existing->isDeclaration();
+}
@@ -19,7 +19,7 @@ public:
 
 	void error(const unexpected_token_error &e) {
 		std::ostringstream s;
-		s	<< context << ":" << e.unexpected.row << ":" << e.unexpected.col
+		s	<< context << ":" << e.location.row << ":" << e.location.col
 			<< ": error: unexpected '" << e.unexpected << "'; expected ";
 		if (e.expected) s << e.expected;
 		else s << e.expected_token;
@@ -67,7 +67,8 @@ llvm::llvm_shutdown_obj y;
 // todo: replace debug with configuration struct
 bool compile(
 	const char *output, const char *target,
-	game &source, build_log &log, bool debug
+	game &source, build_log &log, bool debug,
+	unsigned jobs, const char *cache, bool ir
 ) {
 	error_printer errors(log);
 
@@ -78,6 +79,6 @@ bool compile(
 
 	return linker(
 		output, source, errors,
-		llvm::sys::getDefaultTargetTriple(), context
+		llvm::sys::getDefaultTargetTriple(), context, jobs, cache, ir
 	).build(target, debug);
 }
@@ -14,9 +14,13 @@ protected:
 	build_log() {}
 };
 
+// jobs is the number of threads to compile with, or 0 for one per core
+// cache is a directory to keep compiled functions in between builds, if any
+// ir compiles what it can through the gml ir, rather than straight from the ast
 bool compile(
 	const char *output, const char *target,
-	game &source, build_log &log, bool debug
+	game &source, build_log &log, bool debug,
+	unsigned jobs = 1, const char *cache = 0, bool ir = false
 );
 
 #endif
@@ -103,6 +103,11 @@ public class Runner implements ActionListener, LGM.ReloadListener {
 		return new ImageIcon(url);
 	}
 
+	// compiled functions are kept here between builds
+	private static final File cache = new File(
+		System.getProperty("user.home"), ".dejavu" + File.separator + "cache"
+	);
+
 	private synchronized boolean build(File output, File target, boolean debug) {
 		progress.reset();
 		progress.message("writing game data");
@@ -117,7 +122,8 @@ public class Runner implements ActionListener, LGM.ReloadListener {
 		);
 		boolean success = dejavu.compile(
 			output.getPath(), target.getPath(),
-			source, progress.new Log(), debug
+			source, progress.new Log(), debug,
+			Runtime.getRuntime().availableProcessors(), cache.getPath()
 		);
 
 		if (success) {
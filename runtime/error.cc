@@ -5,7 +5,7 @@
 struct scope;
 
 extern "C" variant show_error(
-	scope *, scope *, const variant &msg, const variant &abort
+	scope *, scope *, variant msg, variant abort
 ) {
 	string *error = to_string(msg);
 	fputs("error: ", stderr);
@@ -1,9 +1,11 @@
 #include <dejavu/runtime/variant.h>
 #include <dejavu/runtime/scope.h>
+#include <cstdio>
 
 extern "C" variant scr_0(scope *self, scope *other, short, variant args[]);
 
-string_pool strings;
+// constructed before the game's initializers intern their string literals
+__attribute__((init_priority(101))) string_pool strings;
 
 int main(int argc, char *argv[]) {
 	variant *args = new variant[argc];
@@ -19,7 +21,7 @@ int main(int argc, char *argv[]) {
 	scope self, other;
 	variant *foo = new variant[1];
 	foo[0] = strings.intern("foo");
-	self[foo->string] = var{1, 1, foo};
+	*self.insert(foo->string) = var{1, 1, foo};
 
 	scr_0(&self, &other, argc, args);
 
@@ -28,5 +30,12 @@ int main(int argc, char *argv[]) {
 	}
 	delete[] args;
 
+#ifdef DEJAVU_LOOKUP_STATS
+	fprintf(
+		stderr, "lookups: %zu hits, %zu misses\n",
+		lookup_stats.hits, lookup_stats.misses
+	);
+#endif
+
 	return 0;
 }
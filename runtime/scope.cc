@@ -1,21 +1,128 @@
 #include <dejavu/runtime/scope.h>
 #include <dejavu/runtime/error.h>
+#include <algorithm>
 
-static scope global;
+lookup_counters lookup_stats;
+
+static inline void count(size_t &counter) {
+#ifdef DEJAVU_LOOKUP_STATS
+	counter++;
+#endif
+}
+
+// instances without a static layout start here and grow as they're assigned to
+static layout empty = { 0, 0, 0, 0 };
+
+layout *layout::add(string *name) {
+	if (!transitions) transitions = new table<string*, layout*>();
+
+	layout *&next = (*transitions)[name];
+	if (!next) {
+		string **grown = new string*[nslots + 1];
+		std::copy(names, names + nslots, grown);
+		grown[nslots] = name;
+		name->retain();
+
+		next = new layout { nslots + 1, grown, 0, 0 };
+	}
+	return next;
+}
+
+ptrdiff_t layout::find(string *name) {
+	if (!index) {
+		index = new table<string*, size_t>();
+		for (size_t i = 0; i < nslots; i++) (*index)[names[i]] = i;
+	}
+
+	table<string*, size_t>::node *n = index->find(name);
+	return n != index->end() ? ptrdiff_t(n->v) : -1;
+}
+
+scope::scope(layout *shape) :
+	shape(shape ? shape : &empty),
+	slots(new var[this->shape->nslots]()), capacity(this->shape->nslots) {}
+
+scope::~scope() {
+	for (size_t i = 0; i < shape->nslots; i++) {
+		release_var(&slots[i]);
+	}
+	delete[] slots;
+}
+
+ptrdiff_t scope::find_slot(string *name) {
+	return shape->find(name);
+}
+
+var *scope::find(string *name) {
+	ptrdiff_t slot = find_slot(name);
+	return slot < 0 ? 0 : &slots[slot];
+}
+
+// don't insert an already-existing variable
+var *scope::insert(string *name) {
+	shape = shape->add(name);
+	if (shape->nslots > capacity) {
+		capacity = std::max<size_t>(4, capacity * 2);
+		var *grown = new var[capacity]();
+		std::copy(slots, slots + shape->nslots - 1, grown);
+		delete[] slots;
+		slots = grown;
+	}
+	return &slots[shape->nslots - 1];
+}
+
+scope global_scope(&global_layout);
+
+// the global scope's slots move as it grows, so globalvars are kept by index
+static table<string*, size_t> globalvar;
+
+// unqualified names can change meaning when a globalvar is declared, so caches
+// for them are only good for the generation they were filled in
+static size_t generation = 1;
 
-static table<string*, var*> globalvar;
 extern "C" void insert_globalvar(string *name) {
-	globalvar[name] = &global[name];
+	if (globalvar.find(name) != globalvar.end()) return;
+
+	ptrdiff_t slot = global_scope.find_slot(name);
+	if (slot < 0) {
+		global_scope.insert(name);
+		slot = global_scope.shape->nslots - 1;
+	}
+
+	globalvar[name] = slot;
+	generation++;
+}
+
+// the slow path of a lookup, which refills the site's cache
+static var *find_variable(
+	scope *self, scope *other, scope *s, string *name, bool lvalue,
+	lookup_cache *cache
+) {
+	ptrdiff_t slot = s->find_slot(name);
+	if (slot < 0) {
+		if (!lvalue) {
+			show_error(self, other, "variable does not exist", true);
+			return 0;
+		}
+
+		s->insert(name);
+		slot = s->shape->nslots - 1;
+	}
+
+	cache->shape = s->shape;
+	cache->slot = slot;
+	return &s->slots[slot];
 }
 
 extern "C" var *lookup(
-	scope *self, scope *other, double id, string *name, bool lvalue
+	scope *self, scope *other, double id, string *name, bool lvalue,
+	lookup_cache *cache
 ) {
 	scope *s = 0;
 	switch ((int)id) {
 	case -1: s = self; break;
 	case -2: s = other; break;
-	case -5: s = &global; break;
+	case -5: s = &global_scope; break;
 
 	// todo: check on all.foo
 	case -3: case -4:
@@ -29,24 +136,39 @@ extern "C" var *lookup(
 	default: return 0;
 	}
 
-	if (s->find(name) == s->end()) {
-		if (!lvalue) {
-			show_error(self, other, "variable does not exist", true);
-			return 0;
-		}
-
-		s->insert(name);
+	if (s->shape == cache->shape) {
+		count(lookup_stats.hits);
+		return &s->slots[cache->slot];
 	}
-	return &(*s)[name];
+
+	count(lookup_stats.misses);
+	return find_variable(self, other, s, name, lvalue, cache);
 }
 
+// a cache with no layout holds a globalvar's slot
 extern "C" var *lookup_default(
-	scope *self, scope *other, string *name, bool lvalue
+	scope *self, scope *other, string *name, bool lvalue, lookup_cache *cache
 ) {
-	table<string*, var*>::node *n = globalvar.find(name);
+	if (cache->generation == generation) {
+		if (!cache->shape) {
+			count(lookup_stats.hits);
+			return &global_scope.slots[cache->slot];
+		}
+		if (cache->shape == self->shape) {
+			count(lookup_stats.hits);
+			return &self->slots[cache->slot];
+		}
+	}
+
+	count(lookup_stats.misses);
+	cache->generation = generation;
+
+	table<string*, size_t>::node *n = globalvar.find(name);
 	if (n != globalvar.end()) {
-		return n->v;
+		cache->shape = 0;
+		cache->slot = n->v;
+		return &global_scope.slots[n->v];
 	}
 
-	return lookup(self, other, -1, name, lvalue);
+	return find_variable(self, other, self, name, lvalue, cache);
 }
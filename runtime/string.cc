@@ -6,7 +6,7 @@
 struct scope;
 
 extern "C" variant string(
-	scope *, scope *, const variant &val
+	scope *, scope *, variant val
 ) {
 	switch (val.type) {
 	case 0: {
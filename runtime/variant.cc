@@ -17,7 +17,7 @@ extern "C" string *to_string(const variant &a) {
 	}
 }
 
-extern "C" __attribute__((pure)) string *intern(string *s) {
+extern "C" string *intern(string *s) {
 	return strings.intern(s);
 }
 
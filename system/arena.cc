@@ -1,40 +1,109 @@
 #include <dejavu/system/arena.h>
 #include <cassert>
+#include <cstdint>
+#include <new>
+
+// slabs stop doubling once they reach this size
+static const size_t max_slab_size = 1 << 20;
+
+static char *align_up(char *p, size_t align) {
+	assert((align & (align - 1)) == 0 && "alignment must be a power of two");
+
+	uintptr_t a = reinterpret_cast<uintptr_t>(p);
+	return reinterpret_cast<char*>((a + align - 1) & ~(uintptr_t)(align - 1));
+}
 
 arena::arena(size_t slab_size) :
-	slab_size(slab_size), current_slab(NULL), bytes_allocated(0) {}
+	slab_size(slab_size), next_size(slab_size),
+	first_slab(NULL), current_slab(NULL), large_slabs(NULL),
+	current(NULL), end(NULL), allocated(0), reserved(0), slabs(0) {}
 
 arena::~arena() {
-	while (current_slab) {
-		slab *next = current_slab->next;
-		::operator delete(current_slab);
-		current_slab = next;
-	}
+	destroy_slabs(first_slab);
+	destroy_slabs(large_slabs);
 }
 
-void *arena::allocate(size_t size) {
-	if (!current_slab) new_slab();
-	bytes_allocated += size;
+void *arena::allocate(size_t size, size_t align) {
+	allocated += size;
+
+	if (current_slab) {
+		char *p = align_up(current, align);
+		if (p <= end && size <= size_t(end - p)) {
+			current = p + size;
+			return p;
+		}
+	}
 
-	char *p = current; // TODO: align
-	if (p + size <= end) {
-		current = p + size;
-		return p;
+	// don't waste the rest of the current slab on a big allocation
+	slab *retained = current_slab ? current_slab->next : NULL;
+	size_t available = (retained ? retained->size : next_size) - sizeof(slab);
+	if (size + align > available / 4) {
+		return allocate_large(size, align);
 	}
 
-	new_slab();
-	p = current; // TODO: align
+	next_slab();
+	char *p = align_up(current, align);
 	current = p + size;
 	assert(current <= end && "Unable to allocate memory");
 	return p;
 }
 
-void arena::new_slab() {
-	slab *s = static_cast<slab*>(::operator new(slab_size));
-	s->size = slab_size;
-	s->next = current_slab;
+// frees large allocations and rewinds to the first slab, keeping the rest
+void arena::reset() {
+	destroy_slabs(large_slabs);
+	large_slabs = NULL;
+
+	allocated = 0;
+	current_slab = first_slab;
+	if (current_slab) {
+		current = reinterpret_cast<char*>(current_slab + 1);
+		end = reinterpret_cast<char*>(current_slab) + current_slab->size;
+	}
+}
+
+// moves to the next retained slab, or adds a new one after the current slab
+void arena::next_slab() {
+	slab *s;
+	if (current_slab && current_slab->next) {
+		s = current_slab->next;
+	}
+	else {
+		s = create_slab(next_size);
+		if (next_size < max_slab_size) next_size *= 2;
+
+		if (current_slab) current_slab->next = s;
+		else first_slab = s;
+	}
 
 	current_slab = s;
 	current = reinterpret_cast<char*>(current_slab + 1);
 	end = reinterpret_cast<char*>(current_slab) + current_slab->size;
 }
+
+void *arena::allocate_large(size_t size, size_t align) {
+	slab *s = create_slab(sizeof(slab) + size + align);
+	s->next = large_slabs;
+	large_slabs = s;
+
+	return align_up(reinterpret_cast<char*>(s + 1), align);
+}
+
+arena::slab *arena::create_slab(size_t size) {
+	slab *s = static_cast<slab*>(::operator new(size));
+	s->size = size;
+	s->next = NULL;
+
+	reserved += size;
+	slabs++;
+	return s;
+}
+
+void arena::destroy_slabs(slab *s) {
+	while (s) {
+		slab *next = s->next;
+		reserved -= s->size;
+		slabs--;
+		::operator delete(s);
+		s = next;
+	}
+}
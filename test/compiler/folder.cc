@@ -0,0 +1,101 @@
+#include <dejavu/compiler/folder.h>
+#include "parse.h"
+#include <string>
+
+namespace {
+
+struct folder : public parse_test {
+	node *fold(const std::string &source, bool expression = false) {
+		node_folder folder(allocator, names);
+		return folder.fold(parse(source, expression));
+	}
+
+	// folds an expression that should become a single constant
+	token constant(const std::string &source) {
+		node *n = fold(source, true);
+		EXPECT_EQ(value_node, n->type);
+		return n->type == value_node ? static_cast<value*>(n)->t : token(eof, 0);
+	}
+
+	double real(const std::string &source) {
+		token t = constant(source);
+		EXPECT_EQ(v_real, t.type);
+		return t.real;
+	}
+
+	std::string text(const std::string &source) {
+		token t = constant(source);
+		EXPECT_EQ(v_string, t.type);
+		return t.type == v_string ? std::string(t.data, t.length) : "";
+	}
+};
+
+}
+
+TEST_F(folder, reals) {
+	EXPECT_EQ(7, real("2 * 3 + 1"));
+	EXPECT_EQ(-4, real("-(3 + 1)"));
+	EXPECT_EQ(1, real("!0"));
+	EXPECT_EQ(-6, real("~5"));
+	EXPECT_EQ(3, real("7 div 2"));
+	EXPECT_EQ(1, real("7 mod 2"));
+	EXPECT_EQ(12, real("3 << 2"));
+	EXPECT_EQ(1, real("true && 2"));
+	EXPECT_EQ(0, real("1 ^^ 2"));
+	EXPECT_EQ(1, real("2 >= 2"));
+	EXPECT_EQ(-1, real("other + 1"));
+}
+
+TEST_F(folder, strings) {
+	EXPECT_EQ("ab", text("\"a\" + 'b'"));
+	EXPECT_EQ(1, real("\"ab\" == 'a' + \"b\""));
+	EXPECT_EQ(0, real("\"1\" == 1"));
+	EXPECT_EQ(1, real("\"1\" != 1"));
+	EXPECT_EQ("0.1", text("string(1 / 10)"));
+	EXPECT_EQ("1e+06", text("string(1000000)"));
+	EXPECT_EQ("x", text("string(\"x\")"));
+}
+
+TEST_F(folder, runtime_errors) {
+	// these fail at runtime, so they have to stay as they are
+	EXPECT_EQ(binary_node, fold("\"a\" - 1", true)->type);
+	EXPECT_EQ(binary_node, fold("\"a\" < \"b\"", true)->type);
+	EXPECT_EQ(unary_node, fold("-\"a\"", true)->type);
+	EXPECT_EQ(binary_node, fold("1 << 40", true)->type);
+	EXPECT_EQ(unary_node, fold("~10000000000", true)->type);
+	EXPECT_EQ(binary_node, fold("x + 1", true)->type);
+}
+
+TEST_F(folder, conditions) {
+	block *b = static_cast<block*>(fold(
+		"if (1 > 2) a = 1 else b = 2;"
+		"while (false) c = 3;"
+		"repeat (2 - 2) d = 4;"
+		"while (2 > 1) break;"
+	));
+
+	ASSERT_EQ(4u, b->stmts.size());
+	EXPECT_EQ(assignment_node, b->stmts[0]->type);
+	EXPECT_EQ(block_node, b->stmts[1]->type);
+	EXPECT_EQ(block_node, b->stmts[2]->type);
+
+	ASSERT_EQ(whilestatement_node, b->stmts[3]->type);
+	expression *cond = static_cast<whilestatement*>(b->stmts[3])->cond;
+	ASSERT_EQ(value_node, cond->type);
+	EXPECT_EQ(v_real, static_cast<value*>(cond)->t.type);
+}
+
+TEST_F(folder, declarations) {
+	// a dead var still makes its names local, so the branch has to stay
+	block *b = static_cast<block*>(fold(
+		"if (false) { var x; }"
+		"switch (y) { case 1: if (0) { case 2: z = 1; } }"
+	));
+
+	ASSERT_EQ(2u, b->stmts.size());
+	EXPECT_EQ(ifstatement_node, b->stmts[0]->type);
+
+	block *cases = static_cast<switchstatement*>(b->stmts[1])->stmts;
+	ASSERT_EQ(2u, cases->stmts.size());
+	EXPECT_EQ(ifstatement_node, cases->stmts[1]->type);
+}
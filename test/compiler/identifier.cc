@@ -0,0 +1,46 @@
+#include <dejavu/compiler/identifier.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+TEST(identifier, intern) {
+	identifier_pool pool;
+
+	std::string a = "player_speed", b = "player_speed", c = "player_spee";
+	const identifier *i1 = pool.intern(a.data(), a.size());
+	const identifier *i2 = pool.intern(b.data(), b.size());
+	const identifier *i3 = pool.intern(c.data(), c.size());
+
+	EXPECT_EQ(i1, i2);
+	EXPECT_NE(i1, i3);
+	EXPECT_EQ(2u, pool.size());
+
+	EXPECT_NE(a.data(), i1->data);
+	EXPECT_EQ(a, std::string(i1->data, i1->length));
+}
+
+TEST(identifier, find) {
+	identifier_pool pool;
+
+	EXPECT_EQ(nullptr, pool.find("x", 1));
+
+	const identifier *x = pool.intern("x", 1);
+	EXPECT_EQ(x, pool.find("x", 1));
+	EXPECT_EQ(nullptr, pool.find("y", 1));
+	EXPECT_EQ(1u, pool.size());
+}
+
+TEST(identifier, grow) {
+	identifier_pool pool;
+
+	std::vector<const identifier*> ids;
+	for (int i = 0; i < 1000; i++) {
+		std::string name = "name" + std::to_string(i);
+		ids.push_back(pool.intern(name.data(), name.size()));
+	}
+
+	for (int i = 0; i < 1000; i++) {
+		std::string name = "name" + std::to_string(i);
+		EXPECT_EQ(ids[i], pool.find(name.data(), name.size()));
+	}
+}
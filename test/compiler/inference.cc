@@ -0,0 +1,124 @@
+#include <dejavu/compiler/inference.h>
+#include "parse.h"
+#include <string>
+
+namespace {
+
+struct inference : public parse_test {
+	inference() : types(names) {}
+
+	void infer(const std::string &source) {
+		program = parse(source);
+		types.infer(program);
+	}
+
+	bool real(const char *name) {
+		const identifier *id = names.find(name, strlen(name));
+		return id && types.is_real(id);
+	}
+
+	node *program;
+	type_inference types;
+};
+
+}
+
+TEST_F(inference, loops) {
+	infer(
+		"var i, n, total;"
+		"n = 10; total = 0;"
+		"for (i = 0; i < n; i += 1) total += i * 2;"
+		"repeat (n) { total = total mod 7; n -= 1; }"
+	);
+
+	EXPECT_TRUE(real("i"));
+	EXPECT_TRUE(real("n"));
+	EXPECT_TRUE(real("total"));
+}
+
+TEST_F(inference, assignments) {
+	infer(
+		"var a, b, c, d, e;"
+		"a = 1; b = a + x; c = x; d = \"s\"; e = 1;"
+		"e = d + \"t\" + string(e);"
+	);
+
+	// anything added to a real has to be a real, or the game stops
+	EXPECT_TRUE(real("a"));
+	EXPECT_TRUE(real("b"));
+	EXPECT_FALSE(real("c"));
+	EXPECT_FALSE(real("d"));
+	EXPECT_FALSE(real("e"));
+}
+
+TEST_F(inference, dependencies) {
+	// b is only real as long as a is, which it isn't
+	infer("var a, b; a = 0; b = a; a = y;");
+	EXPECT_FALSE(real("a"));
+	EXPECT_FALSE(real("b"));
+}
+
+TEST_F(inference, unassigned) {
+	infer(
+		"var a, b, c, d, e, f;"
+		"if (x) a = 1;"
+		"b = a + 1;"
+		"if (x) c = 1 else c = 2;"
+		"while (x) { d = 1; }"
+		"d += 1;"
+		"e = 1; var e; e += 1;"
+		"f = 1; f[1] = 2;"
+	);
+
+	EXPECT_FALSE(real("a"));
+	EXPECT_TRUE(real("b"));
+	EXPECT_TRUE(real("c"));
+	EXPECT_FALSE(real("d"));
+	EXPECT_FALSE(real("e"));
+	EXPECT_FALSE(real("f"));
+}
+
+TEST_F(inference, jumps) {
+	infer(
+		"var a, b, c, d;"
+		"do { a = 1; } until (a > 0);"
+		"while (x) { if (y) { b = 1; break; } b = 2; } c = b;"
+		"switch (x) { case 1: d = 1; break; default: exit; }"
+		"c += d;"
+	);
+
+	EXPECT_TRUE(real("a"));
+	EXPECT_FALSE(real("b"));
+	EXPECT_FALSE(real("c"));
+	EXPECT_TRUE(real("d"));
+}
+
+TEST_F(inference, scope) {
+	// uses before the declaration are instance variables
+	infer("y = x; var x; x = 1; z = x;");
+	EXPECT_TRUE(real("x"));
+
+	value *before = static_cast<value*>(
+		static_cast<assignment*>(static_cast<block*>(program)->stmts[0])->rvalue
+	);
+	value *after = static_cast<value*>(
+		static_cast<assignment*>(static_cast<block*>(program)->stmts[3])->rvalue
+	);
+	EXPECT_EQ(type_any, types.type_of(before));
+	EXPECT_EQ(type_real, types.type_of(after));
+}
+
+TEST_F(inference, scalars) {
+	infer(
+		"var a, b, c, d;"
+		"a = \"s\"; b = x; c = 1; c[2] = 3;"
+		"if (x) d = 1; y = d;"
+	);
+
+	EXPECT_TRUE(types.is_scalar(names.find("a", 1)));
+	EXPECT_TRUE(types.is_scalar(names.find("b", 1)));
+	EXPECT_FALSE(types.is_scalar(names.find("c", 1)));
+	EXPECT_FALSE(types.is_scalar(names.find("d", 1)));
+	EXPECT_FALSE(real("a"));
+	EXPECT_FALSE(real("b"));
+}
@@ -0,0 +1,80 @@
+#include <dejavu/compiler/instance.h>
+#include "parse.h"
+#include <string>
+
+namespace {
+
+struct instance : public parse_test {
+	void collect(const char *source) {
+		uses.collect(parse(source));
+	}
+
+	static std::string join(const std::vector<const identifier*> &names) {
+		std::string result;
+		for (const identifier *name : names) {
+			if (!result.empty()) result += " ";
+			result.append(name->data, name->length);
+		}
+		return result;
+	}
+
+	bool globalvar(const char *name) {
+		const identifier *id = names.find(name, strlen(name));
+		return id && uses.get_globalvars().count(id) > 0;
+	}
+
+	instance_variables uses;
+};
+
+}
+
+TEST_F(instance, names) {
+	collect(
+		"hp = 10; speed = hp * 2;"
+		"var i; for (i = 0; i < 3; i += 1) ammo[i] = 0;"
+		"other.hp = 5; target.score += 1;"
+		"with (other) { gone = 1; }"
+		"instance_destroy(speed);"
+	);
+
+	EXPECT_EQ("hp speed ammo target", join(uses.get_names()));
+}
+
+// arguments belong to the function, so the instance never gets slots for them
+TEST_F(instance, arguments) {
+	collect("x = argument0 + argument[1] + argument_count; argument1 = 2;");
+	EXPECT_EQ("x", join(uses.get_names()));
+}
+
+TEST_F(instance, locals) {
+	// a name only becomes local once it's declared, and only for one program
+	collect("n = 1; var n; n = 2;");
+	collect("m = n;");
+
+	EXPECT_EQ("n m", join(uses.get_names()));
+}
+
+TEST_F(instance, globalvars) {
+	collect("globalvar lives; lives = 3; score = lives;");
+
+	EXPECT_TRUE(globalvar("lives"));
+	EXPECT_FALSE(globalvar("score"));
+}
+
+TEST_F(instance, globals) {
+	collect("global.score = 0; globalvar lives; x = global.level;");
+
+	EXPECT_EQ("score lives level", join(uses.get_globals()));
+	EXPECT_EQ("x", join(uses.get_names()));
+}
+
+TEST_F(instance, calls) {
+	collect("scr_move(1, 2); with (other) scr_move(x); scr_move(3, 4); scr_stop();");
+
+	auto &calls = uses.get_calls();
+	EXPECT_EQ(2u, calls.size());
+	EXPECT_EQ(
+		std::set<size_t>({ 1, 2 }), calls.at(names.find("scr_move", 8))
+	);
+	EXPECT_EQ(std::set<size_t>({ 0 }), calls.at(names.find("scr_stop", 8)));
+}
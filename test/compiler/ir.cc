@@ -0,0 +1,107 @@
+#include <dejavu/compiler/ir_builder.h>
+#include "parse.h"
+#include <string>
+
+namespace {
+
+struct ir : public parse_test {
+	ir() : types(names) {}
+
+	bool build(const std::string &source) {
+		node *program = parse(source);
+		types.infer(program);
+		return ir_builder(names, types, slots).build(program, f);
+	}
+
+	void optimize() {
+		ir_pass_manager passes;
+		passes.add(create_redundant_lookups());
+		passes.add(create_dead_code());
+		passes.run(f);
+	}
+
+	type_inference types;
+	std::unordered_set<const identifier*> slots;
+	ir_function f;
+};
+
+}
+
+TEST_F(ir, loops) {
+	ASSERT_TRUE(build(
+		"var i, total;"
+		"total = 0;"
+		"for (i = 0; i < 10; i += 1) total += i;"
+		"x = total;"
+	));
+
+	// i and total meet at the loop's condition, and nothing else needs a phi
+	EXPECT_EQ(2u, f.count(op_phi)) << f;
+
+	// only x lives in memory, and only its value is boxed
+	EXPECT_EQ(1u, f.count(op_lookup)) << f;
+	EXPECT_EQ(1u, f.count(op_box)) << f;
+}
+
+TEST_F(ir, unsupported) {
+	EXPECT_FALSE(build("with (other) x = 1;"));
+}
+
+// argument# are slots in a clone, and otherwise read from the argument array
+TEST_F(ir, arguments) {
+	slots.insert(names.intern("argument0", 9));
+	EXPECT_TRUE(build("x = argument0;"));
+	EXPECT_EQ(1u, f.count(op_slot)) << f;
+
+	EXPECT_FALSE(build("x = argument1;"));
+}
+
+TEST_F(ir, lookups) {
+	ASSERT_TRUE(build("x = y + y; x += 1;"));
+	EXPECT_EQ(5u, f.count(op_lookup)) << f;
+
+	// y is looked up once, and x's read reuses its write
+	optimize();
+	EXPECT_EQ(2u, f.count(op_lookup)) << f;
+	EXPECT_EQ(2u, f.count(op_access)) << f;
+	EXPECT_EQ(2u, f.count(op_load)) << f;
+}
+
+TEST_F(ir, calls) {
+	ASSERT_TRUE(build("x = 1; f(); x = 2;"));
+	optimize();
+
+	// the script may have moved x
+	EXPECT_EQ(2u, f.count(op_lookup)) << f;
+}
+
+TEST_F(ir, dead_code) {
+	ASSERT_TRUE(build(
+		"var a, b;"
+		"a = 1; b = a + 2;"
+		"return a;"
+	));
+	optimize();
+
+	// b is never used, and neither are the 0s the locals start as
+	EXPECT_EQ(0u, f.count(op_real_binary)) << f;
+	EXPECT_EQ(1u, f.count(op_real)) << f;
+}
+
+TEST_F(ir, short_circuit) {
+	ASSERT_TRUE(build(
+		"var a, b;"
+		"a = 1;"
+		"if (a > 0 && f()) x = 1;"
+		"b = a || f();"
+		"return b;"
+	));
+	optimize();
+
+	// neither call runs unless the left operand leaves the result open
+	for (auto &inst : f.entry()->insts) EXPECT_NE(op_call, inst->opcode) << f;
+	EXPECT_EQ(0u, f.count(op_binary)) << f;
+
+	// b merges the two outcomes of ||
+	EXPECT_EQ(1u, f.count(op_phi)) << f;
+}
@@ -0,0 +1,143 @@
+#include <dejavu/compiler/lexer.h>
+#include <dejavu/compiler/identifier.h>
+#include <dejavu/system/buffer.h>
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static identifier_pool names;
+
+static std::vector<token> lex(const std::string &code) {
+	buffer b(code.size(), code.c_str());
+	token_stream tokens(b, names);
+
+	std::vector<token> result;
+	for (token t = tokens.gettoken(); t.type != eof; t = tokens.gettoken()) {
+		result.push_back(t);
+	}
+	return result;
+}
+
+static source_location at(const std::string &code, const token &t) {
+	buffer b(code.size(), code.c_str());
+	token_stream tokens(b, names);
+	return tokens.locate(t);
+}
+
+static std::string text(const token &t) {
+	if (t.type == v_name) return std::string(t.name->data, t.name->length);
+	return std::string(t.data, t.length);
+}
+
+TEST(lexer, names) {
+	std::string name = "a_very_long_identifier_0123456789_that_spans_vectors";
+	std::string code = name + "+b2 Camel_Case";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(4u, t.size());
+	EXPECT_EQ(v_name, t[0].type);
+	EXPECT_EQ(name, text(t[0]));
+	EXPECT_EQ(plus, t[1].type);
+	EXPECT_EQ("b2", text(t[2]));
+	EXPECT_EQ("Camel_Case", text(t[3]));
+	EXPECT_EQ(name.size() + 5, at(code, t[3]).col);
+}
+
+TEST(lexer, keywords) {
+	std::string code = "if x and not y then exit";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(7u, t.size());
+	EXPECT_EQ(kw_if, t[0].type);
+	EXPECT_EQ(ampamp, t[2].type);
+	EXPECT_EQ(exclaim, t[3].type);
+	EXPECT_EQ(kw_then, t[5].type);
+	EXPECT_EQ(kw_exit, t[6].type);
+}
+
+TEST(lexer, interned) {
+	std::string code = "speed = speed + speedy";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(5u, t.size());
+	EXPECT_EQ(t[0].name, t[2].name);
+	EXPECT_NE(t[0].name, t[4].name);
+	EXPECT_EQ("speedy", text(t[4]));
+}
+
+TEST(lexer, not_keywords) {
+	std::string code = "iff els globalvars continue_ ORR xo returning end";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(8u, t.size());
+	for (size_t i = 0; i < 7; i++) {
+		EXPECT_EQ(v_name, t[i].type) << text(t[i]);
+	}
+	EXPECT_EQ(r_brace, t[7].type);
+}
+
+TEST(lexer, whitespace) {
+	std::string code =
+		"                                        a\n"
+		"\tb\r\n"
+		"  \r  c";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(3u, t.size());
+	EXPECT_EQ(1u, at(code, t[0]).row); EXPECT_EQ(41u, at(code, t[0]).col);
+	EXPECT_EQ(2u, at(code, t[1]).row); EXPECT_EQ(5u, at(code, t[1]).col);
+	EXPECT_EQ(4u, at(code, t[2]).row); EXPECT_EQ(3u, at(code, t[2]).col);
+}
+
+TEST(lexer, comments) {
+	std::string code =
+		"// a single line comment that is longer than one vector\n"
+		"a /* a multi-line comment\n"
+		"   with * and / and // inside, long enough to span vectors */ b\n"
+		"/**/c // trailing";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(3u, t.size());
+	EXPECT_EQ("a", text(t[0])); EXPECT_EQ(2u, at(code, t[0]).row); EXPECT_EQ(1u, at(code, t[0]).col);
+	EXPECT_EQ("b", text(t[1])); EXPECT_EQ(3u, at(code, t[1]).row); EXPECT_EQ(63u, at(code, t[1]).col);
+	EXPECT_EQ("c", text(t[2])); EXPECT_EQ(4u, at(code, t[2]).row); EXPECT_EQ(5u, at(code, t[2]).col);
+}
+
+TEST(lexer, unterminated_comment) {
+	std::string code = "a /* never closed, and longer than a vector *";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(1u, t.size());
+	EXPECT_EQ("a", text(t[0]));
+}
+
+TEST(lexer, strings) {
+	std::string code =
+		"\"a string literal that is long enough to span vectors\" + "
+		"'it''s' \"two\nlines\" x";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(6u, t.size());
+	EXPECT_EQ(v_string, t[0].type);
+	EXPECT_EQ("a string literal that is long enough to span vectors", text(t[0]));
+	EXPECT_EQ("it", text(t[2]));
+	EXPECT_EQ("s", text(t[3]));
+	EXPECT_EQ("two\nlines", text(t[4]));
+	EXPECT_EQ(2u, at(code, t[5]).row);
+}
+
+TEST(lexer, compact) {
+	EXPECT_EQ(16u, sizeof(token));
+
+	std::string code = "a <<= 2.50 \"str\" @";
+	std::vector<token> t = lex(code);
+
+	ASSERT_EQ(6u, t.size());
+	EXPECT_EQ(0u, t[0].position); EXPECT_EQ(1u, t[0].length);
+	EXPECT_EQ(2u, t[1].position); EXPECT_EQ(2u, t[1].length);
+	EXPECT_EQ(4u, t[2].position); EXPECT_EQ(1u, t[2].length);
+	EXPECT_EQ(6u, t[3].position); EXPECT_EQ(4u, t[3].length);
+	EXPECT_EQ(11u, t[4].position); EXPECT_EQ("str", text(t[4]));
+	EXPECT_EQ(unexpected, t[5].type); EXPECT_EQ(18u, at(code, t[5]).col);
+}
@@ -0,0 +1,44 @@
+#ifndef TEST_PARSE_H
+#define TEST_PARSE_H
+
+#include <dejavu/compiler/parser.h>
+#include <dejavu/compiler/identifier.h>
+#include <dejavu/system/buffer.h>
+#include <gtest/gtest.h>
+#include <string>
+
+struct error_counter : public error_stream {
+	void set_context(const std::string&) {}
+	int count() { return errors; }
+
+	void error(const unexpected_token_error&) { errors++; }
+	void error(const redefinition_error&) { errors++; }
+	void error(const unsupported_error&) { errors++; }
+	void error(const std::string&) { errors++; }
+
+	void progress(int, const std::string&) {}
+
+	int errors = 0;
+};
+
+// parses a program, or a single expression, that should have no errors. the
+// tree points into code and allocator, so it lives as long as the fixture
+struct parse_test : public ::testing::Test {
+	node *parse(const std::string &source, bool expression = false) {
+		code = source;
+		buffer b(code.size(), code.data());
+		token_stream tokens(b, names);
+		parser p(tokens, allocator, errors);
+
+		node *program = expression ? p.getargument() : p.getprogram();
+		EXPECT_EQ(0, errors.count());
+		return program;
+	}
+
+	std::string code;
+	identifier_pool names;
+	arena allocator;
+	error_counter errors;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include <dejavu/compiler/refcount.h>
+#include <llvm/Pass.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/SourceMgr.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+namespace {
+
+// a variant local the way codegen spills one, stored as a tag and payload pair
+const char *prelude =
+	"%struct.variant = type { i8, double }\n"
+	"declare void @retain(%struct.variant*)\n"
+	"declare void @release(%struct.variant*)\n";
+
+struct refcount_pass {
+	refcount_pass(const std::string &body) {
+		SMDiagnostic error;
+		module = parseAssemblyString(prelude + body, error, context);
+		EXPECT_TRUE(module != nullptr) << error.getMessage().str();
+
+		std::unique_ptr<FunctionPass> pass(create_refcount_elimination());
+		pass->runOnFunction(*module->getFunction("f"));
+	}
+
+	size_t calls(StringRef name) {
+		size_t n = 0;
+		for (BasicBlock &b : *module->getFunction("f")) {
+			for (Instruction &inst : b) {
+				CallInst *call = dyn_cast<CallInst>(&inst);
+				Function *f = call ? call->getCalledFunction() : 0;
+				if (f && f->getName() == name) n++;
+			}
+		}
+		return n;
+	}
+
+	LLVMContext context;
+	std::unique_ptr<Module> module;
+};
+
+}
+
+TEST(refcount, pairs) {
+	refcount_pass p(
+		"define void @f(i64 %s) {\n"
+		"  %x = alloca %struct.variant\n"
+		"  %p = bitcast %struct.variant* %x to { i8, i64 }*\n"
+		"  %v = insertvalue { i8, i64 } { i8 1, i64 undef }, i64 %s, 1\n"
+		"  store { i8, i64 } %v, { i8, i64 }* %p\n"
+		"  call void @retain(%struct.variant* %x)\n"
+		"  call void @release(%struct.variant* %x)\n"
+		"  ret void\n"
+		"}\n"
+	);
+
+	EXPECT_EQ(0u, p.calls("retain"));
+	EXPECT_EQ(0u, p.calls("release"));
+}
+
+TEST(refcount, reals) {
+	refcount_pass p(
+		"define void @f() {\n"
+		"  %x = alloca %struct.variant\n"
+		"  %p = bitcast %struct.variant* %x to { i8, i64 }*\n"
+		"  store { i8, i64 } { i8 0, i64 0 }, { i8, i64 }* %p\n"
+		"  call void @retain(%struct.variant* %x)\n"
+		"  ret void\n"
+		"}\n"
+	);
+
+	EXPECT_EQ(0u, p.calls("retain"));
+}
+
+// x = "a"; if (c) x = 1; else x = 2;
+// each branch releases the string, so the retain has to stay for both
+TEST(refcount, branches) {
+	refcount_pass p(
+		"define void @f(i1 %c, i64 %s) {\n"
+		"entry:\n"
+		"  %x = alloca %struct.variant\n"
+		"  %p = bitcast %struct.variant* %x to { i8, i64 }*\n"
+		"  %v = insertvalue { i8, i64 } { i8 1, i64 undef }, i64 %s, 1\n"
+		"  store { i8, i64 } %v, { i8, i64 }* %p\n"
+		"  call void @retain(%struct.variant* %x)\n"
+		"  br i1 %c, label %then, label %else\n"
+		"then:\n"
+		"  call void @release(%struct.variant* %x)\n"
+		"  store { i8, i64 } { i8 0, i64 4607182418800017408 }, { i8, i64 }* %p\n"
+		"  br label %merge\n"
+		"else:\n"
+		"  call void @release(%struct.variant* %x)\n"
+		"  store { i8, i64 } { i8 0, i64 4611686018427387904 }, { i8, i64 }* %p\n"
+		"  br label %merge\n"
+		"merge:\n"
+		"  ret void\n"
+		"}\n"
+	);
+
+	EXPECT_EQ(1u, p.calls("retain"));
+	EXPECT_EQ(2u, p.calls("release"));
+}
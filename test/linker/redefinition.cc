@@ -0,0 +1,67 @@
+#include <dejavu/linker/redefinition.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/SourceMgr.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+namespace {
+
+// a unit the way codegen leaves one with a string literal: the script, and
+// an internal initializer that interns the literal at startup
+std::string unit(const std::string &script) {
+	return
+		"@literal = internal global i8* null\n"
+		"@llvm.global_ctors = appending global [1 x { i32, void ()*, i8* }] "
+		"[{ i32, void ()*, i8* } { i32 65535, void ()* @intern_strings, i8* null }]\n"
+		"define internal void @intern_strings() {\n"
+		"  ret void\n"
+		"}\n"
+		"define void @" + script + "() {\n"
+		"  ret void\n"
+		"}\n";
+}
+
+struct units {
+	std::unique_ptr<Module> parse(const std::string &source) {
+		SMDiagnostic error;
+		std::unique_ptr<Module> module(
+			parseAssemblyString(source, error, context)
+		);
+		EXPECT_TRUE(module != nullptr) << error.getMessage().str();
+		return module;
+	}
+
+	size_t redefinitions(const Module &dest, const Module &unit) {
+		size_t n = 0;
+		for (const Function &f : unit) {
+			if (redefines(dest, f)) n++;
+		}
+		return n;
+	}
+
+	LLVMContext context;
+};
+
+}
+
+// every unit has its own intern_strings, which the linker renames
+TEST(redefinition, strings) {
+	units u;
+	std::unique_ptr<Module> dest = u.parse(unit("scr_0"));
+	std::unique_ptr<Module> other = u.parse(unit("scr_1"));
+
+	EXPECT_EQ(0u, u.redefinitions(*dest, *other));
+}
+
+TEST(redefinition, scripts) {
+	units u;
+	std::unique_ptr<Module> dest = u.parse(unit("scr_0"));
+	std::unique_ptr<Module> other = u.parse(unit("scr_0"));
+
+	EXPECT_EQ(1u, u.redefinitions(*dest, *other));
+}
@@ -0,0 +1,14 @@
+#ifndef TEST_RUNTIME_H
+#define TEST_RUNTIME_H
+
+// gtest includes unistd.h, whose access clashes with the runtime's, so the
+// runtime's is declared under another name that links to the same function
+#define access runtime_access
+#include <dejavu/runtime/scope.h>
+#undef access
+
+extern "C" variant *runtime_access(
+	var *a, unsigned short x, unsigned short y, bool lvalue
+) __asm__("access");
+
+#endif
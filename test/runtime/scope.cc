@@ -0,0 +1,27 @@
+#include "runtime.h"
+#include <gtest/gtest.h>
+#include <string>
+
+// the game and its generated code normally define these
+layout global_layout = { 0, 0, 0, 0 };
+string_pool strings;
+
+// a[f()], where f adds variables to self. codegen runs the index before it
+// looks a up, so the access sees where a is after self's slots have moved
+TEST(scope, subscript_grows) {
+	scope self, other;
+	string *a = strings.intern("a");
+	*self.insert(a) = var{ 2, 1, new variant[2]{ 1.0, 2.0 } };
+
+	lookup_cache cache = {};
+	var *before = lookup_default(&self, &other, a, false, &cache);
+
+	for (int i = 0; i < 8; i++) {
+		std::string name = "v" + std::to_string(i);
+		self.insert(strings.intern(name.c_str()));
+	}
+
+	var *after = lookup_default(&self, &other, a, false, &cache);
+	EXPECT_NE(before, after);
+	EXPECT_EQ(2.0, runtime_access(after, 1, 0, false)->real);
+}
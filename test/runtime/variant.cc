@@ -0,0 +1,15 @@
+#include "runtime.h"
+#include <gtest/gtest.h>
+
+// argument# that weren't passed are past the end of the argument array, the
+// same as argument[#], rather than missing instance variables
+TEST(variant, arguments) {
+	variant passed[] = { 1.0, 2.0 };
+	var argument = { 2, 1, passed };
+
+	EXPECT_EQ(2.0, runtime_access(&argument, 1, 0, false)->real);
+	EXPECT_EXIT(
+		runtime_access(&argument, 5, 0, false),
+		::testing::ExitedWithCode(1), "index out of bounds"
+	);
+}
@@ -0,0 +1,65 @@
+#include <dejavu/system/arena.h>
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+
+TEST(arena, align) {
+	arena a;
+
+	a.allocate(1, 1);
+	void *p = a.allocate(8, 8);
+	EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(p) % 8);
+
+	a.allocate(3, 1);
+	void *q = a.allocate(16, 16);
+	EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(q) % 16);
+}
+
+TEST(arena, large) {
+	arena a(256);
+
+	char *small = static_cast<char*>(a.allocate(8));
+	char *large = static_cast<char*>(a.allocate(10000));
+	memset(large, 0, 10000);
+
+	// the current slab is still used after a large allocation
+	char *next = static_cast<char*>(a.allocate(8));
+	EXPECT_EQ(small + 16, next);
+	EXPECT_EQ(2u, a.slab_count());
+}
+
+TEST(arena, grow) {
+	arena a(256);
+
+	for (int i = 0; i < 100; i++) {
+		a.allocate(32);
+	}
+
+	EXPECT_EQ(3200u, a.bytes_allocated());
+	EXPECT_GE(a.bytes_reserved(), 3200u);
+	EXPECT_LT(a.slab_count(), 6u);
+}
+
+TEST(arena, reset) {
+	arena a(256);
+
+	for (int i = 0; i < 100; i++) {
+		a.allocate(32);
+	}
+	a.allocate(10000);
+
+	size_t slabs = a.slab_count();
+	size_t reserved = a.bytes_reserved();
+	a.reset();
+
+	EXPECT_EQ(0u, a.bytes_allocated());
+	EXPECT_EQ(slabs - 1, a.slab_count());
+	EXPECT_LT(a.bytes_reserved(), reserved);
+
+	// the same allocations fit in the retained slabs
+	slabs = a.slab_count();
+	for (int i = 0; i < 100; i++) {
+		a.allocate(32);
+	}
+	EXPECT_EQ(slabs, a.slab_count());
+}